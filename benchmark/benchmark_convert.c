@@ -0,0 +1,180 @@
+// Deinterleave and scale benchmark for the ADC read path. The library source is compiled in,
+// so the conversion kernels are measured directly, against the per-sample loop they replaced.
+#include "zet017tcp.c"
+
+#define BENCH_CHANNELS 8
+#define BENCH_RING_FRAMES 65536
+#define BENCH_MAX_FRAMES 50000
+#define BENCH_CALLS 20
+#define BENCH_ROUNDS 100
+
+struct reference_ring {
+	uint8_t* buffer;
+	uint32_t size;
+	uint16_t sample_size;
+	uint16_t amplify_code[ZET017_MAX_CHANNELS_ADC + 1];
+	float resolution[ZET017_MAX_CHANNELS_ADC + 1][ZET017_MAX_GAINS_ADC];
+};
+
+// The loop zet017_channel_get_data ran before the kernels: a sample size branch, a wrap check
+// and a scale lookup for every sample.
+static void reference_channel(struct reference_ring* ring, uint32_t channel, uint32_t pointer, float* data, uint32_t size) {
+	uint32_t step = ring->sample_size * BENCH_CHANNELS;
+	uint32_t channel_size = ring->size / step;
+	uint32_t p = pointer;
+	if (p >= size)
+		p -= size;
+	else
+		p = p + channel_size - size;
+	p *= step;
+	p += channel * ring->sample_size;
+	for (uint32_t i = 0; i < size; ++i, p += step) {
+		if (p >= ring->size)
+			p -= ring->size;
+
+		if (ring->sample_size == sizeof(int16_t))
+			data[i] = (float)(*(int16_t*)(ring->buffer + p));
+		else if (ring->sample_size == sizeof(int32_t))
+			data[i] = (float)(*(int32_t*)(ring->buffer + p));
+		data[i] *= ring->resolution[channel][ring->amplify_code[channel]];
+	}
+}
+
+// What zet017_channel_get_data does now: one kernel call per contiguous part of the ring.
+static void kernel_channel(struct reference_ring* ring, uint32_t channel, uint32_t pointer, float* data, uint32_t size) {
+	uint32_t step = ring->sample_size * BENCH_CHANNELS;
+	uint32_t channel_size = ring->size / step;
+	zet017_convert_func convert = ring->sample_size == sizeof(int16_t) ? zet017_convert.int16 : zet017_convert.int32;
+	float resolution = ring->resolution[channel][ring->amplify_code[channel]];
+	uint32_t p = pointer;
+	if (p >= size)
+		p -= size;
+	else
+		p = p + channel_size - size;
+	for (uint32_t i = 0; i < size;) {
+		uint32_t count = channel_size - p;
+		if (count > size - i)
+			count = size - i;
+		convert(ring->buffer + p * step + channel * ring->sample_size, step, resolution, data + i, count);
+		i += count;
+		p = 0;
+	}
+}
+
+static double bench_time(void) {
+	return (double)zet017_get_time_us() * 1e-6;
+}
+
+typedef void (*bench_read_func)(struct reference_ring* ring, uint32_t channel, uint32_t pointer, float* data, uint32_t size);
+
+// One pass over all channels, averaged over several calls.
+static double bench_channels(bench_read_func read, struct reference_ring* ring, float** data, uint32_t frames) {
+	double start = bench_time();
+	for (uint32_t call = 0; call < BENCH_CALLS; ++call) {
+		for (uint32_t channel = 0; channel < BENCH_CHANNELS; ++channel)
+			read(ring, channel, 1000, data[channel], frames);
+	}
+	return (bench_time() - start) / BENCH_CALLS;
+}
+
+static double bench_frames(const struct zet017_frames_layout* layout, uint32_t frames) {
+	uint32_t p = 1000 + layout->channel_size - frames;
+	double start = bench_time();
+	for (uint32_t call = 0; call < BENCH_CALLS; ++call)
+		zet017_frames_convert(layout, p, frames, layout->channel_size);
+	return (bench_time() - start) / BENCH_CALLS;
+}
+
+static void bench_frames_layout(struct reference_ring* ring, float** data, struct zet017_frames_layout* layout) {
+	struct zet017_adc_ring adc;
+	memset(&adc, 0, sizeof(adc));
+	adc.buffer = ring->buffer;
+	adc.size = ring->size;
+	adc.channel_mask = (1 << BENCH_CHANNELS) - 1;
+	adc.work_channel = adc.channel_quantity = BENCH_CHANNELS;
+	adc.sample_size = ring->sample_size;
+	memcpy(adc.resolution, ring->resolution, sizeof(adc.resolution));
+	zet017_frames_layout_init(&adc, data, BENCH_CHANNELS, layout);
+}
+
+static int bench_check(float** expected, float** data, uint32_t frames) {
+	for (uint32_t channel = 0; channel < BENCH_CHANNELS; ++channel) {
+		if (memcmp(expected[channel], data[channel], frames * sizeof(float)) != 0)
+			return -1;
+	}
+	return 0;
+}
+
+int main(void) {
+	zet017_convert_setup();
+
+	float* expected[BENCH_CHANNELS];
+	float* data[BENCH_CHANNELS];
+	for (uint32_t channel = 0; channel < BENCH_CHANNELS; ++channel) {
+		expected[channel] = malloc(BENCH_MAX_FRAMES * sizeof(float));
+		data[channel] = malloc(BENCH_MAX_FRAMES * sizeof(float));
+		if (expected[channel] == NULL || data[channel] == NULL)
+			return 1;
+	}
+
+	int result = 0;
+	for (uint16_t sample_size = sizeof(int16_t); sample_size <= sizeof(int32_t); sample_size *= 2) {
+		struct reference_ring ring;
+		memset(&ring, 0, sizeof(ring));
+		ring.sample_size = sample_size;
+		ring.size = BENCH_RING_FRAMES * BENCH_CHANNELS * sample_size;
+		ring.buffer = malloc(ring.size);
+		if (ring.buffer == NULL)
+			return 1;
+		for (uint32_t i = 0; i < ring.size / sample_size; ++i) {
+			if (sample_size == sizeof(int16_t))
+				((int16_t*)ring.buffer)[i] = (int16_t)(i * 7);
+			else
+				((int32_t*)ring.buffer)[i] = (int32_t)(i * 7919);
+		}
+		for (uint32_t channel = 0; channel < BENCH_CHANNELS; ++channel)
+			ring.resolution[channel][0] = 1.f / (float)(channel + 1);
+
+		// 100 ms at 50 kHz stays in cache; a second's worth streams through memory, which bounds
+		// a single-channel read that uses 4 bytes of every 32.
+		for (uint32_t frames = BENCH_MAX_FRAMES / 10; frames <= BENCH_MAX_FRAMES; frames *= 10) {
+			// The variants take turns in every round and the best round of each counts,
+			// so that a noisy neighbour on the host does not favour one of them.
+			struct zet017_frames_layout layout;
+			bench_frames_layout(&ring, data, &layout);
+			double reference = 1e30, channels = 1e30, converted = 1e30;
+			for (uint32_t round = 0; round < BENCH_ROUNDS; ++round) {
+				double time = bench_channels(reference_channel, &ring, expected, frames);
+				if (time < reference)
+					reference = time;
+				time = bench_channels(kernel_channel, &ring, data, frames);
+				if (time < channels)
+					channels = time;
+				if (round == 0 && bench_check(expected, data, frames) != 0)
+					result = 1;
+				time = bench_frames(&layout, frames);
+				if (time < converted)
+					converted = time;
+				if (round == 0 && bench_check(expected, data, frames) != 0)
+					result = 1;
+			}
+
+			printf("int%u, %u channels x %u frames:\n", sample_size * 8, BENCH_CHANNELS, frames);
+			printf("  per-sample loop          %8.1f us\n", reference * 1e6);
+			printf("  zet017_channel_get_data  %8.1f us  %.1fx\n", channels * 1e6, reference / channels);
+			printf("  zet017_device_get_frames %8.1f us  %.1fx\n", converted * 1e6, reference / converted);
+		}
+
+		free(ring.buffer);
+	}
+
+	for (uint32_t channel = 0; channel < BENCH_CHANNELS; ++channel) {
+		free(expected[channel]);
+		free(data[channel]);
+	}
+
+	if (result != 0)
+		printf("conversion results differ from the per-sample loop\n");
+
+	return result;
+}
@@ -0,0 +1,230 @@
+// Device layout benchmark: reader threads take the stream state and copy the ADC ring layout,
+// as every data call does, while an ingest thread bumps the counters and ring positions the way
+// a receive does. The library source is compiled in, so struct zet017_device is measured as it is,
+// against the order its fields had before they were split across cache lines.
+// Usage: benchmark_layout [readers], 3 readers by default. Run it on a machine with at least
+// readers + 1 cores, otherwise the threads take turns and no cache line is ever contended.
+#include "zet017tcp.c"
+
+#define BENCH_READERS 8
+#define BENCH_SECONDS 1.
+#define BENCH_ROUNDS 3
+
+// The fields both sides touch, as struct zet017_device had them before: the counters right before
+// the state readers lock, the ring positions on the line of the generation readers check. Both blocks
+// are placed at the offsets they had in a 64-bit Linux build, which sets what shares a cache line.
+#define BENCH_BEFORE_STATE 904
+#define BENCH_BEFORE_ADC 2568
+#define BENCH_BEFORE_SIZE 4096
+
+struct before_state {
+	struct zet017_adc_dac_data adc_dac_data;
+	struct zet017_state state;
+	mutex_t state_mutex;
+};
+
+struct before_adc {
+	struct zet017_adc_ring ring;
+	uint32_t generation;
+	size_t mapped;
+	struct zet017_retired_buffer* retired;
+	uint32_t pointer;
+	uint64_t sequence;
+	uint64_t sequence_pending;
+};
+
+struct bench_fields {
+	mutex_t* state_mutex;
+	struct zet017_state* state;
+	uint32_t* generation;
+	struct zet017_adc_ring* ring;
+
+	uint64_t* adc_count;
+	uint32_t* pointer;
+	uint64_t* sequence;
+	uint64_t* sequence_pending;
+};
+
+struct bench_thread {
+	struct bench_fields* fields;
+	volatile uint32_t* stop;
+	uint64_t count;
+	thread_t thread;
+};
+
+// What zet017_device_get_state and zet017_adc_ring_read do.
+static THREAD_RETURN bench_reader(void* arg) {
+	struct bench_thread* reader = arg;
+	struct bench_fields* fields = reader->fields;
+	struct zet017_state state;
+	struct zet017_adc_ring ring;
+	uint64_t count = 0;
+	while (!atomic_load_u32(reader->stop)) {
+		mutex_lock(fields->state_mutex);
+		memcpy(&state, fields->state, sizeof(state));
+		mutex_unlock(fields->state_mutex);
+
+		for (uint32_t round = 0;; ++round) {
+			uint32_t generation = atomic_load_u32(fields->generation);
+			if (generation & 1) {
+				thread_backoff(round);
+				continue;
+			}
+
+			memcpy(&ring, fields->ring, sizeof(ring));
+			memory_fence();
+			if (atomic_load_u32(fields->generation) == generation)
+				break;
+		}
+		++count;
+	}
+	reader->count = count;
+
+	return 0;
+}
+
+// What zet017_receive_adc_direct writes for every batch, without the socket.
+static THREAD_RETURN bench_ingest(void* arg) {
+	struct bench_thread* ingest = arg;
+	struct bench_fields* fields = ingest->fields;
+	uint32_t size = fields->ring->size;
+	uint32_t batch = 4096;
+	uint64_t count = 0;
+	while (!atomic_load_u32(ingest->stop)) {
+		uint64_t sequence = *fields->sequence + batch;
+		atomic_store_u64(fields->sequence_pending, sequence);
+		memory_fence();
+
+		*fields->pointer += batch;
+		if (*fields->pointer >= size)
+			*fields->pointer -= size;
+		*fields->adc_count += batch / 32;
+		atomic_store_u64(fields->sequence, sequence);
+		++count;
+	}
+	ingest->count = count;
+
+	return 0;
+}
+
+static int bench_start(struct bench_thread* thread, int ingest) {
+#if defined(ZET017_TCP_WINDOWS)
+	thread->thread = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE)(ingest ? bench_ingest : bench_reader), thread, 0, NULL);
+	return thread->thread != NULL ? 0 : -1;
+#else
+	return pthread_create(&thread->thread, NULL, ingest ? bench_ingest : bench_reader, thread) == 0 ? 0 : -1;
+#endif
+}
+
+static void bench_join(struct bench_thread* thread) {
+#if defined(ZET017_TCP_WINDOWS)
+	WaitForSingleObject(thread->thread, INFINITE);
+	CloseHandle(thread->thread);
+#else
+	pthread_join(thread->thread, NULL);
+#endif
+}
+
+// Reader calls and ingest batches per second, with and without the ingest thread running.
+static int bench_run(struct bench_fields* fields, uint32_t readers, int ingesting, double* reads, double* batches) {
+	volatile uint32_t stop = 0;
+	struct bench_thread threads[BENCH_READERS + 1];
+	uint32_t count = readers + (ingesting ? 1 : 0);
+	for (uint32_t i = 0; i < count; ++i) {
+		threads[i].fields = fields;
+		threads[i].stop = &stop;
+		threads[i].count = 0;
+	}
+
+	uint64_t start = zet017_get_time_us();
+	uint32_t started = 0;
+	for (; started < count; ++started) {
+		if (bench_start(&threads[started], started >= readers) != 0)
+			break;
+	}
+	if (started == count)
+		thread_sleep((uint32_t)(BENCH_SECONDS * 1000));
+	atomic_store_u32(&stop, 1);
+	for (uint32_t i = 0; i < started; ++i)
+		bench_join(&threads[i]);
+	double seconds = (double)(zet017_get_time_us() - start) * 1e-6;
+	if (started != count)
+		return -1;
+
+	uint64_t total = 0;
+	for (uint32_t i = 0; i < readers; ++i)
+		total += threads[i].count;
+	*reads = (double)total / seconds;
+	*batches = ingesting ? (double)threads[readers].count / seconds : 0.;
+
+	return 0;
+}
+
+static void bench_print(const char* name, double reads, double batches, double idle) {
+	printf("  %-24s %7.2f M reads/s (%.2f of idle)  %7.2f M batches/s\n",
+		name, reads * 1e-6, reads / idle, batches * 1e-6);
+}
+
+int main(int argc, char** argv) {
+	uint32_t readers = argc > 1 ? (uint32_t)atoi(argv[1]) : 3;
+	if (readers == 0 || readers > BENCH_READERS) {
+		printf("readers: 1 .. %u\n", BENCH_READERS);
+		return 1;
+	}
+
+	uint8_t* memory = cache_aligned_alloc(BENCH_BEFORE_SIZE);
+	struct zet017_device* after = cache_aligned_alloc(sizeof(struct zet017_device));
+	if (memory == NULL || after == NULL)
+		return 1;
+	memset(memory, 0, BENCH_BEFORE_SIZE);
+	memset(after, 0, sizeof(struct zet017_device));
+	struct before_state* state = (struct before_state*)(memory + BENCH_BEFORE_STATE);
+	struct before_adc* adc = (struct before_adc*)(memory + BENCH_BEFORE_ADC);
+	mutex_init(&state->state_mutex);
+	mutex_init(&after->state_mutex);
+	adc->ring.size = after->adc_data.ring.size = ZET017_ADC_BUFFER_SIZE;
+
+	struct bench_fields layouts[2] = {
+		{ &state->state_mutex, &state->state, &adc->generation, &adc->ring,
+			&state->adc_dac_data.adc_count, &adc->pointer, &adc->sequence, &adc->sequence_pending },
+		{ &after->state_mutex, &after->state, &after->adc_data.generation, &after->adc_data.ring,
+			&after->adc_dac_data.adc_count, &after->adc_data.pointer, &after->adc_data.sequence,
+			&after->adc_data.sequence_pending },
+	};
+	const char* names[2] = { "before", "struct zet017_device" };
+
+	printf("generation and ring position 64-byte lines: before %u and %u, now %u and %u\n",
+		(uint32_t)((BENCH_BEFORE_ADC + offsetof(struct before_adc, generation)) / ZET017_CACHE_LINE),
+		(uint32_t)((BENCH_BEFORE_ADC + offsetof(struct before_adc, pointer)) / ZET017_CACHE_LINE),
+		(uint32_t)((offsetof(struct zet017_device, adc_data) + offsetof(struct zet017_adc_data, generation)) / ZET017_CACHE_LINE),
+		(uint32_t)((offsetof(struct zet017_device, adc_data) + offsetof(struct zet017_adc_data, pointer)) / ZET017_CACHE_LINE));
+
+	// The layouts take turns in every round and the best round of each counts.
+	double idle[2] = { 0., 0. }, reads[2] = { 0., 0. }, batches[2] = { 0., 0. };
+	for (uint32_t round = 0; round < BENCH_ROUNDS; ++round) {
+		for (uint32_t i = 0; i < 2; ++i) {
+			double r, b;
+			if (bench_run(&layouts[i], readers, 0, &r, &b) != 0)
+				return 1;
+			if (r > idle[i])
+				idle[i] = r;
+			if (bench_run(&layouts[i], readers, 1, &r, &b) != 0)
+				return 1;
+			if (r > reads[i])
+				reads[i] = r;
+			if (b > batches[i])
+				batches[i] = b;
+		}
+	}
+
+	printf("%u readers, one ingest thread:\n", readers);
+	for (uint32_t i = 0; i < 2; ++i)
+		bench_print(names[i], reads[i], batches[i], idle[i]);
+
+	mutex_destroy(&state->state_mutex);
+	mutex_destroy(&after->state_mutex);
+	cache_aligned_free(memory);
+	cache_aligned_free(after);
+
+	return 0;
+}
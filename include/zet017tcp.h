@@ -17,8 +17,20 @@ extern "C" {
 #define ZET017_TCP_API int
 #endif
 
+#define ZET017_IO_THREADS_AUTO 0xffffffff
+
+#define ZET017_DEVICE_HUGEPAGES 0x1
+
+#define ZET017_DAC_WINDOW_LOW_LATENCY 0
+
+#define ZET017_WAIT_INFINITE 0xffffffff
+
+#define ZET017_CONNECT_HISTOGRAM 12
+
 struct zet017_server;
 
+struct zet017_request;
+
 enum zet017_scheme {
 	unknown = -1,
 
@@ -27,6 +39,21 @@ enum zet017_scheme {
 	quarter_bridge,
 };
 
+enum zet017_dac_underrun {
+	zet017_dac_underrun_zero = 0,
+	zet017_dac_underrun_hold,
+};
+
+enum zet017_connect_error {
+	zet017_connect_error_none = 0,
+	zet017_connect_error_system,
+	zet017_connect_error_connect,
+	zet017_connect_error_timeout,
+	zet017_connect_error_handshake,
+	zet017_connect_error_init,
+	zet017_connect_error_aborted,
+};
+
 struct zet017_config {
 	uint32_t sample_rate_adc;
 	uint16_t moda_adc;
@@ -64,36 +91,179 @@ struct zet017_state {
 	uint32_t buffer_size_dac;
 };
 
+struct zet017_connect_stats {
+	uint64_t attempts;
+	uint64_t failures;
+	enum zet017_connect_error last_error;
+	int system_error;
+	uint32_t last_connect_time;
+	uint32_t backoff;
+	uint32_t histogram[ZET017_CONNECT_HISTOGRAM];
+};
+
+struct zet017_device_params {
+	double adc_seconds;
+	double dac_seconds;
+	uint32_t flags;
+};
+
+struct zet017_adc_span {
+	const void* data;
+	uint32_t size;
+};
+
+struct zet017_adc_view {
+	uint64_t sequence;
+	uint16_t sample_size;
+	uint16_t work_channel;
+	uint32_t channel_mask;
+	struct zet017_adc_span span[2];
+};
+
+struct zet017_adc_block {
+	struct zet017_adc_span span[2];
+	uint32_t frames;
+	uint16_t sample_size;
+	uint16_t work_channel;
+	uint32_t channel_mask;
+	uint64_t frame;
+	uint64_t sequence;
+};
+
+struct zet017_dac_block {
+	void* data;
+	uint32_t frames;
+	uint16_t sample_size;
+	uint16_t work_channel;
+	uint32_t channel_mask;
+	uint64_t frame;
+	float resolution[2];
+};
+
+struct zet017_dac_stats {
+	uint64_t sent;
+	uint64_t underrun;
+	uint64_t late;
+	uint32_t window;
+};
+
+struct zet017_start_info {
+	int result;
+	uint64_t start_time;
+	uint64_t first_packet_time;
+};
+
+typedef void (*zet017_adc_callback)(void* context, const struct zet017_adc_block* block);
+
+typedef uint32_t (*zet017_dac_callback)(void* context, struct zet017_dac_block* block);
+
+typedef void (*zet017_request_callback)(void* context, int result);
+
 ZET017_TCP_API zet017_server_create(struct zet017_server** server_ptr);
 
 ZET017_TCP_API zet017_server_free(struct zet017_server** server_ptr);
 
+ZET017_TCP_API zet017_server_set_io_threads(struct zet017_server* server, uint32_t count);
+
+ZET017_TCP_API zet017_server_set_cache_dir(struct zet017_server* server, const char* path);
+
 ZET017_TCP_API zet017_server_add_device(struct zet017_server* server, const char* ip);
 
+ZET017_TCP_API zet017_server_add_device_ex(struct zet017_server* server, const char* ip, const struct zet017_device_params* params);
+
 ZET017_TCP_API zet017_server_remove_device(struct zet017_server* server, const char* ip);
 
+ZET017_TCP_API zet017_server_find_device(struct zet017_server* server, const char* ip, uint32_t* number);
+
+ZET017_TCP_API zet017_server_find_device_by_serial(struct zet017_server* server, uint32_t serial, uint32_t* number);
+
 ZET017_TCP_API zet017_device_get_info(struct zet017_server* server, uint32_t number, struct zet017_info* info);
 
 ZET017_TCP_API zet017_device_get_state(struct zet017_server* server, uint32_t number, struct zet017_state* state);
 
+ZET017_TCP_API zet017_device_set_receive_buffer(struct zet017_server* server, uint32_t number, uint32_t size);
+
+ZET017_TCP_API zet017_device_set_connect_timeout(struct zet017_server* server, uint32_t number, uint32_t timeout_ms);
+
+ZET017_TCP_API zet017_device_set_reconnect_policy(struct zet017_server* server, uint32_t number, uint32_t min_interval_ms, uint32_t max_interval_ms);
+
+ZET017_TCP_API zet017_device_reconnect_now(struct zet017_server* server, uint32_t number);
+
+ZET017_TCP_API zet017_device_get_connect_stats(struct zet017_server* server, uint32_t number, struct zet017_connect_stats* stats);
+
+ZET017_TCP_API zet017_device_set_dac_underrun_policy(struct zet017_server* server, uint32_t number, enum zet017_dac_underrun policy);
+
+ZET017_TCP_API zet017_device_set_adc_callback(struct zet017_server* server, uint32_t number, zet017_adc_callback callback, void* context);
+
+ZET017_TCP_API zet017_device_set_dac_callback(struct zet017_server* server, uint32_t number, zet017_dac_callback callback, void* context);
+
+ZET017_TCP_API zet017_device_set_dac_window(struct zet017_server* server, uint32_t number, uint32_t ms);
+
+ZET017_TCP_API zet017_device_get_dac_stats(struct zet017_server* server, uint32_t number, struct zet017_dac_stats* stats);
+
 ZET017_TCP_API zet017_device_get_config(struct zet017_server* server, uint32_t number, struct zet017_config* config);
 
 ZET017_TCP_API zet017_device_get_tenso_config(struct zet017_server* server, uint32_t number, struct zet017_tenso_config* config);
 
 ZET017_TCP_API zet017_device_set_config(struct zet017_server* server, uint32_t number, const struct zet017_config* config);
 
+ZET017_TCP_API zet017_device_set_config_async(struct zet017_server* server, uint32_t number, const struct zet017_config* config,
+	zet017_request_callback callback, void* context, struct zet017_request** request);
+
 ZET017_TCP_API zet017_device_set_tenso_config(struct zet017_server* server, uint32_t number, const struct zet017_tenso_config* config);
 
+ZET017_TCP_API zet017_device_set_tenso_config_async(struct zet017_server* server, uint32_t number, const struct zet017_tenso_config* config,
+	zet017_request_callback callback, void* context, struct zet017_request** request);
+
 ZET017_TCP_API zet017_device_start(struct zet017_server* server, uint32_t number, uint32_t dac);
 
+ZET017_TCP_API zet017_device_start_async(struct zet017_server* server, uint32_t number, uint32_t dac,
+	zet017_request_callback callback, void* context, struct zet017_request** request);
+
 ZET017_TCP_API zet017_device_stop(struct zet017_server* server, uint32_t number);
 
+ZET017_TCP_API zet017_device_stop_async(struct zet017_server* server, uint32_t number,
+	zet017_request_callback callback, void* context, struct zet017_request** request);
+
+ZET017_TCP_API zet017_request_poll(struct zet017_request* request, int* result);
+
+ZET017_TCP_API zet017_request_wait(struct zet017_request* request, uint32_t timeout_ms, int* result);
+
+ZET017_TCP_API zet017_request_free(struct zet017_request** request);
+
+ZET017_TCP_API zet017_server_start_group(struct zet017_server* server, const uint32_t* numbers, uint32_t count, uint32_t dac, struct zet017_start_info* info);
+
+ZET017_TCP_API zet017_server_stop_group(struct zet017_server* server, const uint32_t* numbers, uint32_t count, int* results);
+
+ZET017_TCP_API zet017_device_get_start_info(struct zet017_server* server, uint32_t number, struct zet017_start_info* info);
+
 ZET017_TCP_API zet017_channel_get_data(
 	struct zet017_server* server, uint32_t number, uint32_t channel, uint32_t pointer, float* data, uint32_t size);
 
+ZET017_TCP_API zet017_device_get_frames(
+	struct zet017_server* server, uint32_t number, uint32_t pointer, float** data, uint32_t count, uint32_t size);
+
+ZET017_TCP_API zet017_device_get_adc_position(struct zet017_server* server, uint32_t number, uint64_t* first, uint64_t* end);
+
+ZET017_TCP_API zet017_device_read_frames(
+	struct zet017_server* server, uint32_t number, uint64_t frame, float** data, uint32_t count, uint32_t size);
+
+ZET017_TCP_API zet017_device_wait_for_samples(
+	struct zet017_server* server, uint32_t number, uint32_t pointer, uint32_t frames, uint32_t timeout_ms);
+
+ZET017_TCP_API zet017_device_set_notify(struct zet017_server* server, uint32_t number, uint32_t watermark, intptr_t* fd);
+
+ZET017_TCP_API zet017_device_adc_view(
+	struct zet017_server* server, uint32_t number, uint64_t sequence, struct zet017_adc_view* view);
+
+ZET017_TCP_API zet017_device_adc_check(struct zet017_server* server, uint32_t number, const struct zet017_adc_view* view);
+
 ZET017_TCP_API zet017_channel_put_data(
 	struct zet017_server* server, uint32_t number, uint32_t channel, uint32_t pointer, float* data, uint32_t size);
 
+ZET017_TCP_API zet017_device_put_frames(
+	struct zet017_server* server, uint32_t number, uint32_t pointer, float** data, uint32_t count, uint32_t size);
+
 #ifdef __cplusplus
 }
 #endif
@@ -8,6 +8,7 @@
 #if defined(_WIN32)
 #define WIN32_LEAN_AND_MEAN
 #define ZET017_TCP_WINDOWS
+#include <malloc.h>
 #include <winsock2.h>
 #include <ws2tcpip.h>
 #define socket_t SOCKET
@@ -15,15 +16,28 @@
 typedef HANDLE thread_t;
 typedef CRITICAL_SECTION mutex_t;
 typedef CONDITION_VARIABLE cond_t;
+typedef WSABUF iovec_t;
+typedef WSAPOLLFD pollfd_t;
+#define poll_sockets(fds, count, timeout) WSAPoll(fds, count, timeout)
 #define THREAD_RETURN DWORD WINAPI
 #else
 #include <arpa/inet.h>
 #include <netinet/tcp.h>
+#include <poll.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
 #include <pthread.h>
+#include <sched.h>
 #include <time.h>
 #include <unistd.h>
+#if defined(__linux__)
+#define ZET017_TCP_EPOLL
+#define ZET017_TCP_EVENTFD
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
 #define socket_t int
 #define INVALID_SOCKET (-1)
 #define SOCKET_ERROR (-1)
@@ -31,9 +45,43 @@ typedef CONDITION_VARIABLE cond_t;
 typedef pthread_t thread_t;
 typedef pthread_mutex_t mutex_t;
 typedef pthread_cond_t cond_t;
+typedef struct iovec iovec_t;
+typedef struct pollfd pollfd_t;
+#define poll_sockets(fds, count, timeout) poll(fds, count, timeout)
 #define THREAD_RETURN void*
 #endif
 
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define ZET017_TCP_X86
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__aarch64__) || defined(_M_ARM64)
+#define ZET017_TCP_NEON
+#include <arm_neon.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define ZET017_TARGET(x) __attribute__((target(x)))
+#define ZET017_INLINE inline __attribute__((always_inline))
+#elif defined(_MSC_VER)
+#define ZET017_TARGET(x)
+#define ZET017_INLINE __forceinline
+#else
+#define ZET017_TARGET(x)
+#define ZET017_INLINE inline
+#endif
+
+// Fields written by the network thread and fields written by API threads are kept on separate cache lines.
+#define ZET017_CACHE_LINE 64
+
+#if defined(_MSC_VER)
+#define ZET017_CACHE_ALIGNED __declspec(align(64))
+#else
+#define ZET017_CACHE_ALIGNED __attribute__((aligned(ZET017_CACHE_LINE)))
+#endif
+
 #include "zet017tcp.h"
 
 #define MAX_IP_LENGTH 16
@@ -50,6 +98,13 @@ typedef pthread_cond_t cond_t;
 
 #define ZET017_PACKET_SIZE 1024
 #define ZET017_MAX_FLUSH_SIZE 2048
+#define ZET017_CONNECT_TIMEOUT 10000
+#define ZET017_CONNECT_TIMEOUT_MAX 60000
+#define ZET017_RECONNECT_MIN_INTERVAL 100
+#define ZET017_RECONNECT_MAX_INTERVAL 10000
+#define ZET017_RECONNECT_INTERVAL_MAX 600000
+#define ZET017_CALIBRATION_MAGIC 0x4c414358
+#define ZET017_CALIBRATION_FORMAT 1
 
 #define ZET017_MAX_SAMPLE_RATE_ADC 50000
 #define ZET017_MAX_CHANNELS_ADC 8
@@ -57,13 +112,40 @@ typedef pthread_cond_t cond_t;
 #define ZET017_MAX_SAMPLE_SIZE_ADC sizeof(int32_t)
 #define ZET017_MAX_ADC_BUFFER_SIZE (ZET017_MAX_SAMPLE_RATE_ADC * (ZET017_MAX_CHANNELS_ADC + 1) * ZET017_MAX_SAMPLE_SIZE_ADC) * 2
 #define ZET017_ADC_GR_BUFFER_SIZE (1 * 2 * 3 * 2 * 5 * 1 * 7 * 2 * 3 * sizeof(int32_t))
-#define ZET017_ADC_BUFFER_SIZE (ZET017_MAX_ADC_BUFFER_SIZE / ZET017_ADC_GR_BUFFER_SIZE + 1) * ZET017_ADC_GR_BUFFER_SIZE
+#define ZET017_ADC_BUFFER_SIZE ((ZET017_MAX_ADC_BUFFER_SIZE / ZET017_ADC_GR_BUFFER_SIZE + 1) * ZET017_ADC_GR_BUFFER_SIZE)
+#define ZET017_FRAMES_BLOCK_SIZE 256
+
+#define ZET017_RECEIVE_BUFFER_SIZE (64 * ZET017_PACKET_SIZE)
+#define ZET017_MAX_RECEIVE_BUFFER_SIZE (1024 * ZET017_PACKET_SIZE)
+#define ZET017_RECEIVE_MAX_PACKETS 256
 
 #define ZET017_MAX_SAMPLE_RATE_DAC 200000
 #define ZET017_MAX_CHANNELS_DAC 2
 #define ZET017_MAX_SAMPLE_SIZE_DAC sizeof(int32_t)
 #define ZET017_MAX_DAC_BUFFER_SIZE (ZET017_MAX_SAMPLE_RATE_DAC * ZET017_MAX_CHANNELS_DAC* ZET017_MAX_SAMPLE_SIZE_DAC)
-#define ZET017_DAC_BUFFER_SIZE ZET017_MAX_DAC_BUFFER_SIZE * 4
+#define ZET017_DAC_BUFFER_SIZE (ZET017_MAX_DAC_BUFFER_SIZE * 4)
+#define ZET017_DAC_GR_BUFFER_SIZE ZET017_PACKET_SIZE
+#define ZET017_DAC_WINDOW_DEFAULT_MS 200
+#define ZET017_DAC_WINDOW_MAX_MS 10000
+
+#define ZET017_MAX_RING_SIZE (0x40000000 / ZET017_ADC_GR_BUFFER_SIZE * ZET017_ADC_GR_BUFFER_SIZE)
+#define ZET017_HUGEPAGE_SIZE (2 * 1024 * 1024)
+
+#define ZET017_WORKER_TIMEOUT 100
+#define ZET017_WORKER_MAX_EVENTS 64
+#define ZET017_CONTROL_THREADS_PER_WORKER 2
+#define ZET017_CONTROL_THREADS_MIN 4
+
+#define ZET017_EVENT_READ 0x1
+#define ZET017_EVENT_WRITE 0x2
+
+enum zet017_event_source {
+	zet017_event_wakeup = 0,
+	zet017_event_cmd,
+	zet017_event_adc,
+	zet017_event_dac,
+	zet017_event_count,
+};
 
 enum zet017_command {
 	zet017_set_config = 0,
@@ -72,13 +154,6 @@ enum zet017_command {
 	zet017_stop,
 };
 
-enum zet017_command_state {
-	zet017_command_idle = 0,
-	zet017_command_requested,
-	zet017_command_processing,
-	zet017_command_completed,
-};
-
 struct zet017_device_info {
 	uint16_t command;				//0x000: код команды (0x0000 — GetInfo)
 	uint8_t reserve_1[2];
@@ -160,18 +235,110 @@ union zet017_packet {
 	struct zet017_command_info cmd;
 };
 
-struct zet017_command_data {
-	union zet017_packet data;
+// A set of start or stop requests sent together. Each worker keeps its request queued, and goes on
+// streaming, until the caller has seen every device arrive and releases them all at once.
+struct zet017_group {
+	uint32_t count;
+	uint32_t arrived;
+	uint16_t released;
+	mutex_t mutex;
+	cond_t cond;
+};
+
+struct zet017_request {
 	enum zet017_command command;
-	enum zet017_command_state state;
+	union {
+		struct zet017_config config;
+		struct zet017_tenso_config tenso_config;
+		uint32_t dac;
+	} args;
 	int result;
+	uint16_t completed;
+	uint16_t refs;
+	zet017_request_callback callback;
+	void* context;
+	struct zet017_group* group;
+	uint16_t arrived;
+	// A start already sent; result then holds the outcome of the send until the reply is in.
+	uint16_t sent;
 	mutex_t mutex;
 	cond_t cond;
+	struct zet017_request* next;
 };
 
-struct zet017_adc_data {
-	uint8_t buffer[ZET017_ADC_BUFFER_SIZE];
-	uint32_t pointer;
+// Requests queue up in order and are taken by the worker, which builds the packet at that point,
+// so every command is based on the device state left by the ones before it.
+struct zet017_command_data {
+	union zet017_packet data;
+	struct zet017_request* head;
+	struct zet017_request* tail;
+	mutex_t mutex;
+};
+
+// Reconnect schedule and connection metrics. The worker owns the schedule; the mutex covers
+// the policy, the metrics and the nudge, and the condition wakes a dedicated thread early.
+struct zet017_connect_data {
+	uint32_t min_interval;
+	uint32_t max_interval;
+	uint32_t backoff;
+	uint32_t next;
+	uint16_t scheduled;
+	uint16_t nudge;
+	uint32_t seed;
+
+	uint64_t attempts;
+	uint64_t failures;
+	enum zet017_connect_error error;
+	int system_error;
+	uint32_t last_time;
+	uint32_t histogram[ZET017_CONNECT_HISTOGRAM];
+
+	mutex_t mutex;
+	cond_t cond;
+};
+
+// Which device the correction and tenso blocks in the device structure were read from.
+// They are reused as long as a reconnect finds the same serial and firmware version.
+struct zet017_calibration {
+	uint16_t valid;
+	uint32_t serial;
+	char version[32];
+};
+
+// Calibration cache file, one per serial, in host byte order.
+struct zet017_calibration_file {
+	uint32_t magic;
+	uint16_t format;
+	uint16_t size;
+	uint32_t serial;
+	char version[32];
+	struct zet017_correction_info correction;
+	struct zet017_tenso_info tenso;
+	uint32_t checksum;
+};
+
+struct zet017_receive_data {
+	uint8_t* buffer;
+	uint32_t size;
+	uint32_t fill;
+	// Written by API threads, applied by the network thread before its next receive.
+	uint32_t request;
+	uint32_t offset;
+	uint8_t padding[ZET017_PACKET_SIZE];
+};
+
+struct zet017_retired_buffer {
+	uint8_t* buffer;
+	size_t mapped;
+	struct zet017_retired_buffer* next;
+};
+
+// Ring geometry and sample layout of the ADC stream. Only the device worker writes it, between
+// zet017_adc_ring_begin() and zet017_adc_ring_end(); other threads work on a copy from zet017_adc_ring_read().
+struct zet017_adc_ring {
+	uint8_t* buffer;
+	uint32_t size;
+	uint64_t sequence_start;
 	uint32_t channel_mask;
 	uint16_t work_channel;
 	uint16_t channel_quantity;
@@ -179,13 +346,31 @@ struct zet017_adc_data {
 	uint16_t amplify_code[ZET017_MAX_CHANNELS_ADC + 1];
 
 	float resolution[ZET017_MAX_CHANNELS_ADC + 1][ZET017_MAX_GAINS_ADC];
+};
 
-	mutex_t mutex;
+struct zet017_adc_data {
+	struct zet017_adc_ring ring;
+	uint32_t generation;
+	size_t mapped;
+	struct zet017_retired_buffer* retired;
+
+	// Written by the network thread on every batch.
+	ZET017_CACHE_ALIGNED uint32_t pointer;
+	uint64_t sequence;
+	uint64_t sequence_pending;
+
+	zet017_adc_callback callback;
+	void* context;
+	mutex_t callback_mutex;
 };
 
 struct zet017_dac_data {
-	uint8_t buffer[ZET017_DAC_BUFFER_SIZE];
-	uint32_t pointer;
+	uint8_t* buffer;
+	uint32_t size;
+	size_t mapped;
+	uint32_t* stamp;
+	uint32_t epoch;
+	enum zet017_dac_underrun underrun;
 	uint32_t channel_mask;
 	uint16_t channel_quantity;
 	uint16_t sample_size;
@@ -193,6 +378,14 @@ struct zet017_dac_data {
 	float resolution[ZET017_MAX_CHANNELS_DAC];
 
 	mutex_t mutex;
+
+	// Written by the network thread on every packet.
+	ZET017_CACHE_ALIGNED uint32_t pointer;
+	uint8_t hold[ZET017_MAX_CHANNELS_DAC * ZET017_MAX_SAMPLE_SIZE_DAC];
+
+	zet017_dac_callback callback;
+	void* context;
+	mutex_t callback_mutex;
 };
 
 struct zet017_adc_dac_data {
@@ -204,27 +397,69 @@ struct zet017_adc_dac_data {
 	uint16_t work_channel_dac;
 	uint16_t sample_size_dac;
 	uint64_t dac_count;
+
+	uint32_t dac_window_ms;
+	uint32_t dac_window;
+	uint32_t dac_window_packets;
+	uint64_t dac_underrun;
+	uint64_t dac_late;
+	uint64_t dac_late_mark;
+
+	uint64_t start_time;
+	uint64_t first_packet_time;
+};
+
+// Readers blocked in zet017_device_wait_for_samples() or a group call, and the optional readiness descriptor.
+// Each waiter is counted from before it leaves the registry until it returns, so the device outlives every wait.
+struct zet017_notify_data {
+	socket_t signal[2];
+	uint32_t watermark;
+	uint64_t mark;
+	uint32_t waiters;
+	uint16_t closed;
+	mutex_t mutex;
+	cond_t cond;
+};
+
+struct zet017_events {
+#if defined(ZET017_TCP_EPOLL)
+	int fd;
+#endif
+	socket_t socket[zet017_event_count];
+	uint32_t interest[zet017_event_count];
+	uint32_t ready[zet017_event_count];
 };
 
 struct zet017_device {
 	char ip[MAX_IP_LENGTH];
+	// What the API calls the device; given out once, it does not change while other devices come and go.
+	uint32_t number;
 	socket_t cmd_socket;
 	socket_t adc_socket;
 	socket_t dac_socket;
+	// Lives as long as the device; on Linux both ends are the same eventfd.
 	socket_t wakeup_socket[2];
 
 	thread_t work_thread;
 	uint16_t running;
 
+	struct zet017_worker* worker;
+	struct zet017_device* worker_next;
+	uint16_t worker_ready;
+	// Connect, commands and the periodic info request of a pooled device run on the control pool,
+	// so a round trip to one device never holds up the others on the worker.
+	uint32_t control;
+	uint16_t control_connect;
+	struct zet017_device* control_next;
+
 	uint16_t is_connected;
 	uint64_t reconnect;
 	uint32_t timestamp;
+	uint32_t connect_timeout;
+	struct zet017_connect_data connect;
+	struct zet017_device_params params;
 	struct zet017_device_info device_info;
 	struct zet017_tenso_info tenso_info;
-	struct zet017_adc_dac_data adc_dac_data;
-
-	struct zet017_state state;
-	mutex_t state_mutex;
 
 	struct zet017_info info;
 	mutex_t info_mutex;
@@ -235,18 +470,110 @@ struct zet017_device {
 
 	struct zet017_command_data command;
 
+	struct zet017_correction_info correction;
+	struct zet017_calibration calibration;
+
+	struct zet017_server* server;
+	struct zet017_device* next;
+
+	// Taken by every API call that reads the stream.
+	ZET017_CACHE_ALIGNED struct zet017_state state;
+	mutex_t state_mutex;
+	struct zet017_notify_data notify;
+
+	// Network thread. The counters it bumps per batch share no cache line with the locks above,
+	// and the ring positions are split from what readers copy or lock, see zet017_adc_data and zet017_dac_data.
+	ZET017_CACHE_ALIGNED struct zet017_adc_dac_data adc_dac_data;
+	struct zet017_events events;
+	struct zet017_receive_data receive;
 	struct zet017_adc_data adc_data;
 	struct zet017_dac_data dac_data;
+};
 
-	struct zet017_correction_info correction;
+enum zet017_control {
+	zet017_control_idle,
+	zet017_control_running,
+	zet017_control_done
+};
 
-	struct zet017_device* next;
+// A fixed set of threads shared by the workers for everything that waits for a device. Connects queue
+// apart from commands and take at most half of the threads: an unreachable device holds one for the
+// whole connect timeout, commands to the devices that are up still get through.
+struct zet017_control_pool {
+	thread_t* threads;
+	uint32_t count;
+	uint16_t running;
+	uint32_t connecting;
+	struct zet017_device* head[2];
+	struct zet017_device* tail[2];
+	mutex_t mutex;
+	// Signalled when a device is queued, a connect slot frees up or the pool stops.
+	cond_t cond;
+	// Broadcast whenever a device is handed back.
+	cond_t done;
+};
+
+struct zet017_worker {
+	thread_t thread;
+	uint16_t running;
+	uint32_t timestamp;
+
+	struct zet017_device* devices;
+	uint32_t device_count;
+	// Devices are stepped without the mutex; removal waits until the current one is let go.
+	struct zet017_device* current;
+	mutex_t mutex;
+	cond_t cond;
+	// Raised by the control pool once it hands a device back.
+	socket_t signal[2];
+#if defined(ZET017_TCP_EPOLL)
+	int events_fd;
+#else
+	pollfd_t* polls;
+	struct zet017_device** poll_devices;
+	uint32_t poll_size;
+#endif
+};
+
+// Immutable snapshot of the device list. API calls read it without locks inside a reader section,
+// writers publish a new snapshot and retire the old one once no reader can still hold it.
+// The hash tables map device numbers, addresses and serials to list positions.
+struct zet017_registry {
+	uint32_t count;
+	uint32_t mask;
+	struct zet017_device** devices;
+	uint32_t* serial;
+	uint32_t* by_number;
+	uint32_t* by_ip;
+	uint32_t* by_serial;
+	struct zet017_registry* retired;
+};
+
+struct zet017_reader_count {
+	ZET017_CACHE_ALIGNED volatile uint32_t count;
 };
 
 struct zet017_server {
 	struct zet017_device* devices;
 	size_t device_count;
 	mutex_t devices_mutex;
+	// Group calls run one at a time; two groups sharing devices would each hold a device the other waits for.
+	mutex_t group_mutex;
+
+	struct zet017_registry* volatile registry;
+	struct zet017_registry* retired;
+	// Set when a device reported a serial the snapshot may not have indexed yet.
+	volatile uint32_t registry_stale;
+	uint32_t next_number;
+	// Every API call reads the epoch and bumps one of the reader counts, each of them has a line of its own.
+	ZET017_CACHE_ALIGNED volatile uint32_t epoch;
+	struct zet017_reader_count readers[2];
+
+	struct zet017_worker* workers;
+	uint32_t worker_count;
+	struct zet017_control_pool control;
+
+	char* cache_dir;
 };
 
 static int mutex_init(mutex_t* mutex) {
@@ -307,6 +634,25 @@ static void cond_wait(cond_t* cond, mutex_t* mutex) {
 #endif
 }
 
+static int cond_timedwait(cond_t* cond, mutex_t* mutex, uint32_t timeout_ms) {
+#if defined(ZET017_TCP_WINDOWS)
+	if (!SleepConditionVariableCS(cond, mutex, timeout_ms))
+		return -1;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += timeout_ms / 1000;
+	ts.tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+	if (ts.tv_nsec >= 1000000000) {
+		++ts.tv_sec;
+		ts.tv_nsec -= 1000000000;
+	}
+	if (pthread_cond_timedwait(cond, mutex, &ts) != 0)
+		return -1;
+#endif
+	return 0;
+}
+
 static void cond_signal(cond_t* cond) {
 #if defined(ZET017_TCP_WINDOWS)
 	WakeConditionVariable(cond);
@@ -315,6 +661,129 @@ static void cond_signal(cond_t* cond) {
 #endif
 }
 
+static void cond_broadcast(cond_t* cond) {
+#if defined(ZET017_TCP_WINDOWS)
+	WakeAllConditionVariable(cond);
+#else
+	pthread_cond_broadcast(cond);
+#endif
+}
+
+static uint64_t atomic_load_u64(volatile uint64_t* value) {
+#if defined(ZET017_TCP_WINDOWS)
+	return (uint64_t)InterlockedCompareExchange64((volatile LONG64*)value, 0, 0);
+#else
+	return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+#endif
+}
+
+static void atomic_store_u64(volatile uint64_t* value, uint64_t desired) {
+#if defined(ZET017_TCP_WINDOWS)
+	InterlockedExchange64((volatile LONG64*)value, (LONG64)desired);
+#else
+	__atomic_store_n(value, desired, __ATOMIC_RELEASE);
+#endif
+}
+
+static uint32_t atomic_load_u32(volatile uint32_t* value) {
+#if defined(ZET017_TCP_WINDOWS)
+	return (uint32_t)InterlockedCompareExchange((volatile LONG*)value, 0, 0);
+#else
+	return __atomic_load_n(value, __ATOMIC_SEQ_CST);
+#endif
+}
+
+static void atomic_store_u32(volatile uint32_t* value, uint32_t desired) {
+#if defined(ZET017_TCP_WINDOWS)
+	InterlockedExchange((volatile LONG*)value, (LONG)desired);
+#else
+	__atomic_store_n(value, desired, __ATOMIC_SEQ_CST);
+#endif
+}
+
+static void atomic_add_u32(volatile uint32_t* value, int32_t delta) {
+#if defined(ZET017_TCP_WINDOWS)
+	InterlockedExchangeAdd((volatile LONG*)value, (LONG)delta);
+#else
+	__atomic_fetch_add(value, (uint32_t)delta, __ATOMIC_SEQ_CST);
+#endif
+}
+
+static void* atomic_load_ptr(void* volatile* value) {
+#if defined(ZET017_TCP_WINDOWS)
+	return InterlockedCompareExchangePointer(value, NULL, NULL);
+#else
+	return __atomic_load_n(value, __ATOMIC_SEQ_CST);
+#endif
+}
+
+static void atomic_store_ptr(void* volatile* value, void* desired) {
+#if defined(ZET017_TCP_WINDOWS)
+	InterlockedExchangePointer(value, desired);
+#else
+	__atomic_store_n(value, desired, __ATOMIC_SEQ_CST);
+#endif
+}
+
+static void thread_sleep(uint32_t ms) {
+#if defined(ZET017_TCP_WINDOWS)
+	Sleep(ms);
+#else
+	struct timespec ts = { ms / 1000, (long)(ms % 1000) * 1000000 };
+	nanosleep(&ts, NULL);
+#endif
+}
+
+// One round of a retry loop waiting on another thread: a CPU pause for the first rounds, then
+// the rest of the time slice, so that a writer descheduled mid-update gets the core back.
+#define THREAD_SPIN_ROUNDS 64
+
+static void thread_backoff(uint32_t round) {
+	if (round >= THREAD_SPIN_ROUNDS) {
+#if defined(ZET017_TCP_WINDOWS)
+		SwitchToThread();
+#else
+		sched_yield();
+#endif
+		return;
+	}
+
+#if defined(ZET017_TCP_X86)
+	_mm_pause();
+#elif defined(ZET017_TCP_NEON) && defined(_MSC_VER)
+	__yield();
+#elif defined(ZET017_TCP_NEON)
+	__asm__ __volatile__("yield");
+#endif
+}
+
+static void memory_fence(void) {
+#if defined(ZET017_TCP_WINDOWS)
+	MemoryBarrier();
+#else
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+#endif
+}
+
+static void* cache_aligned_alloc(size_t size) {
+#if defined(ZET017_TCP_WINDOWS)
+	return _aligned_malloc(size, ZET017_CACHE_LINE);
+#else
+	void* memory = NULL;
+	if (posix_memalign(&memory, ZET017_CACHE_LINE, size) != 0)
+		return NULL;
+	return memory;
+#endif
+}
+
+static void cache_aligned_free(void* memory) {
+#if defined(ZET017_TCP_WINDOWS)
+	_aligned_free(memory);
+#else
+	free(memory);
+#endif
+}
+
 static int network_init(void) {
 #if defined(ZET017_TCP_WINDOWS)
 	WSADATA wsaData;
@@ -330,6 +799,129 @@ static void network_cleanup(void) {
 #endif
 }
 
+static int zet017_events_init(struct zet017_events* events) {
+	memset(events, 0x0, sizeof(struct zet017_events));
+	for (uint32_t i = 0; i < zet017_event_count; ++i)
+		events->socket[i] = INVALID_SOCKET;
+#if defined(ZET017_TCP_EPOLL)
+	events->fd = epoll_create1(EPOLL_CLOEXEC);
+	if (events->fd == -1)
+		return -1;
+#endif
+	return 0;
+}
+
+static void zet017_events_cleanup(struct zet017_events* events) {
+#if defined(ZET017_TCP_EPOLL)
+	if (events->fd != -1) {
+		close(events->fd);
+		events->fd = -1;
+	}
+#endif
+}
+
+static int zet017_events_update(struct zet017_events* events, enum zet017_event_source source, uint32_t interest) {
+	if (events->socket[source] == INVALID_SOCKET)
+		interest = 0;
+	if (events->interest[source] == interest)
+		return 0;
+
+#if defined(ZET017_TCP_EPOLL)
+	struct epoll_event event;
+	memset(&event, 0x0, sizeof(event));
+	event.data.u32 = source;
+	if (interest & ZET017_EVENT_READ)
+		event.events |= EPOLLIN;
+	if (interest & ZET017_EVENT_WRITE)
+		event.events |= EPOLLOUT;
+
+	// Sources without interest are removed, otherwise a hang-up on an idle socket would keep waking the wait.
+	int op = EPOLL_CTL_MOD;
+	if (interest == 0)
+		op = EPOLL_CTL_DEL;
+	else if (events->interest[source] == 0)
+		op = EPOLL_CTL_ADD;
+	if (epoll_ctl(events->fd, op, events->socket[source], &event) != 0)
+		return -1;
+#endif
+	events->interest[source] = interest;
+
+	return 0;
+}
+
+static void zet017_events_attach(struct zet017_events* events, enum zet017_event_source source, socket_t sock) {
+	events->socket[source] = sock;
+	events->interest[source] = 0;
+}
+
+static void zet017_events_detach(struct zet017_events* events, enum zet017_event_source source) {
+	(void)zet017_events_update(events, source, 0);
+	events->socket[source] = INVALID_SOCKET;
+}
+
+#if !defined(ZET017_TCP_EPOLL)
+static void zet017_poll_set(pollfd_t* poll, socket_t sock, uint32_t interest) {
+	poll->fd = sock;
+	poll->events = 0;
+	if (interest & ZET017_EVENT_READ)
+		poll->events |= POLLIN;
+	if (interest & ZET017_EVENT_WRITE)
+		poll->events |= POLLOUT;
+	poll->revents = 0;
+}
+
+// An error or hang-up counts as every event asked for, the following recv or send reports it.
+static uint32_t zet017_poll_ready(const pollfd_t* poll, uint32_t interest) {
+	uint32_t ready = 0;
+	if (poll->revents & POLLIN)
+		ready |= ZET017_EVENT_READ;
+	if (poll->revents & POLLOUT)
+		ready |= ZET017_EVENT_WRITE;
+	if (poll->revents & (POLLERR | POLLHUP | POLLNVAL))
+		ready |= interest;
+
+	return ready;
+}
+#endif
+
+static int zet017_events_wait(struct zet017_events* events, const uint32_t* interest, int timeout_ms) {
+	for (uint32_t i = 0; i < zet017_event_count; ++i) {
+		events->ready[i] = 0;
+		if (zet017_events_update(events, (enum zet017_event_source)i, interest[i]) != 0)
+			return -1;
+	}
+
+#if defined(ZET017_TCP_EPOLL)
+	struct epoll_event ready[zet017_event_count];
+	int r = epoll_wait(events->fd, ready, zet017_event_count, timeout_ms);
+	for (int i = 0; i < r; ++i) {
+		uint32_t source = ready[i].data.u32;
+		if (ready[i].events & EPOLLIN)
+			events->ready[source] |= ZET017_EVENT_READ;
+		if (ready[i].events & EPOLLOUT)
+			events->ready[source] |= ZET017_EVENT_WRITE;
+		if (ready[i].events & (EPOLLERR | EPOLLHUP))
+			events->ready[source] |= events->interest[source];
+	}
+#else
+	pollfd_t polls[zet017_event_count];
+	uint32_t sources[zet017_event_count];
+	uint32_t count = 0;
+	for (uint32_t i = 0; i < zet017_event_count; ++i) {
+		if (events->interest[i] == 0)
+			continue;
+		zet017_poll_set(&polls[count], events->socket[i], events->interest[i]);
+		sources[count++] = i;
+	}
+
+	int r = poll_sockets(polls, count, timeout_ms);
+	for (uint32_t i = 0; r > 0 && i < count; ++i)
+		events->ready[sources[i]] = zet017_poll_ready(&polls[i], events->interest[sources[i]]);
+#endif
+
+	return r;
+}
+
 static uint32_t zet017_get_timestamp(void) {
 #if defined(ZET017_TCP_WINDOWS)
 	return GetTickCount();
@@ -348,6 +940,22 @@ static uint32_t zet017_get_timestamp(void) {
 #endif
 }
 
+static uint64_t zet017_get_time_us(void) {
+#if defined(ZET017_TCP_WINDOWS)
+	LARGE_INTEGER counter, frequency;
+	QueryPerformanceCounter(&counter);
+	QueryPerformanceFrequency(&frequency);
+
+	return (uint64_t)(counter.QuadPart / frequency.QuadPart * 1000000 + counter.QuadPart % frequency.QuadPart * 1000000 / frequency.QuadPart);
+#else
+	struct timespec ts;
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+		return 0;
+
+	return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+#endif
+}
+
 static uint32_t zet017_get_sample_rate_adc(uint16_t mode_adc) {
 	switch (mode_adc) {
 	case 1:
@@ -443,1277 +1051,4858 @@ static void zet017_set_size_packet_adc(struct zet017_device_info* info) {
 	info->size_packet_adc = size_packet_adc;
 }
 
-static struct zet017_device* zet017_get_device(struct zet017_server* server, uint32_t number) {
-	if (server && server->device_count > number) {
-		struct zet017_device* device = server->devices;
-		while (device != NULL) {
-			if (number == 0)
-				return device;
+typedef void (*zet017_convert_func)(const uint8_t* src, uint32_t step, float scale, float* dst, uint32_t count);
+typedef void (*zet017_quantize_func)(const float* src, float scale, uint8_t* dst, uint32_t step, uint32_t count);
+typedef void (*zet017_interleave_func)(
+	const float* src0, float scale0, const float* src1, float scale1, uint8_t* dst, uint32_t count);
+typedef void (*zet017_deinterleave_func)(const uint8_t* src, const float* scale, float* const* dst, uint32_t count);
+
+// Frame width the deinterleave kernels take apart in one pass: a full ZET 017 channel set.
+#define ZET017_DEINTERLEAVE_CHANNELS 8
+
+struct zet017_convert_kernels {
+	zet017_convert_func int16;
+	zet017_convert_func int32;
+	zet017_quantize_func quantize_int16;
+	zet017_quantize_func quantize_int32;
+	zet017_interleave_func interleave_int16;
+	zet017_interleave_func interleave_int32;
+	zet017_deinterleave_func deinterleave_int16;
+	zet017_deinterleave_func deinterleave_int32;
+};
 
-			--number;
-			device = device->next;
-		}
-	}
+// DAC codes are rounded to nearest and saturated. The int32 bound is the largest float below 2^31,
+// which is where the vector conversions saturate too; NaN becomes 0.
+#define ZET017_QUANTIZE_INT16_MIN -32768.f
+#define ZET017_QUANTIZE_INT16_MAX 32767.f
+#define ZET017_QUANTIZE_INT32_MIN -2147483648.f
+#define ZET017_QUANTIZE_INT32_MAX 2147483520.f
 
-	return NULL;
+static int32_t zet017_quantize_value(float value, float min, float max) {
+	if (!(value == value))
+		return 0;
+	if (value < min)
+		value = min;
+	else if (value > max)
+		value = max;
+
+	// Round half to even without libm, the same as the vector conversions in the default mode.
+	int32_t code = (int32_t)value;
+	float fraction = value - (float)code;
+	if (fraction > 0.5f || (fraction == 0.5f && (code & 1)))
+		++code;
+	else if (fraction < -0.5f || (fraction == -0.5f && (code & 1)))
+		--code;
+
+	return code;
 }
 
-static socket_t zet017_socket_connect(const char* ip, unsigned short port) {
-	socket_t sock = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
-	if (sock == INVALID_SOCKET)
-		return INVALID_SOCKET;
+static void zet017_quantize_int16_scalar(const float* src, float scale, uint8_t* dst, uint32_t step, uint32_t count) {
+	for (uint32_t i = 0; i < count; ++i, dst += step)
+		*(int16_t*)dst = (int16_t)zet017_quantize_value(src[i] * scale, ZET017_QUANTIZE_INT16_MIN, ZET017_QUANTIZE_INT16_MAX);
+}
 
-	for (;;) {
-		struct sockaddr_in addr;
-		memset(&addr, 0, sizeof(addr));
-		addr.sin_family = AF_INET;
-		if (inet_pton(AF_INET, ip, &addr.sin_addr) <= 0)
-			break;
-		addr.sin_port = htons(port);
+static void zet017_quantize_int32_scalar(const float* src, float scale, uint8_t* dst, uint32_t step, uint32_t count) {
+	for (uint32_t i = 0; i < count; ++i, dst += step)
+		*(int32_t*)dst = zet017_quantize_value(src[i] * scale, ZET017_QUANTIZE_INT32_MIN, ZET017_QUANTIZE_INT32_MAX);
+}
 
-#if defined(ZET017_TCP_WINDOWS)
-		u_long mode = 1;
-		if (ioctlsocket(sock, FIONBIO, &mode) != 0)
-#else
-		int mode = 1;
-		if (ioctl(sock, FIONBIO, &mode) < 0)
-#endif
-			break;
+static void zet017_interleave_int16_scalar(
+	const float* src0, float scale0, const float* src1, float scale1, uint8_t* dst, uint32_t count) {
+	zet017_quantize_int16_scalar(src0, scale0, dst, 2 * sizeof(int16_t), count);
+	zet017_quantize_int16_scalar(src1, scale1, dst + sizeof(int16_t), 2 * sizeof(int16_t), count);
+}
 
-		int r = connect(sock, (struct sockaddr*)&addr, sizeof(addr));
-		if (r == SOCKET_ERROR) {
-#if defined(ZET017_TCP_WINDOWS)
-			int r = WSAGetLastError();
-			if (r != WSAEWOULDBLOCK && r != WSAEINPROGRESS)
-#else
-			if (errno != EINPROGRESS)
-#endif
-				break;
-		}
+static void zet017_interleave_int32_scalar(
+	const float* src0, float scale0, const float* src1, float scale1, uint8_t* dst, uint32_t count) {
+	zet017_quantize_int32_scalar(src0, scale0, dst, 2 * sizeof(int32_t), count);
+	zet017_quantize_int32_scalar(src1, scale1, dst + sizeof(int32_t), 2 * sizeof(int32_t), count);
+}
 
-		return sock;
-	}
-
-	close_socket(sock);
-
-	return INVALID_SOCKET;
+static void zet017_convert_int16_scalar(const uint8_t* src, uint32_t step, float scale, float* dst, uint32_t count) {
+	for (uint32_t i = 0; i < count; ++i, src += step)
+		dst[i] = (float)(*(const int16_t*)src) * scale;
 }
 
-static int zet017_socket_wait_connect(struct zet017_device* device, socket_t* sock) {
-	fd_set rfds;
-	FD_ZERO(&rfds);
-	FD_SET(device->wakeup_socket[1], &rfds);
-
-	fd_set wfds;
-	FD_ZERO(&wfds);
-	FD_SET(*sock, &wfds);
-
-	int nfds = (int)(*sock > device->wakeup_socket[1] ? *sock : device->wakeup_socket[1]);
-
-	struct timeval tv;
-	tv.tv_sec = 10;
-	tv.tv_usec = 0;
-
-	int r = select(nfds + 1, &rfds, &wfds, NULL, &tv);
-	if (r != -1 && r != 0) {
-		if (FD_ISSET(*sock, &wfds)) {
-			int optval = 0;
-			int optlen = sizeof(optval);
-			r = getsockopt(*sock, SOL_SOCKET, SO_ERROR, (char*)&optval, &optlen);
-			if (r == 0 && optval == 0) {
-				optlen = sizeof(optval);
-				optval = 1;
-				(void)setsockopt(*sock, SOL_SOCKET, SO_KEEPALIVE, (const char*)&optval, optlen);
-
-#if defined(TCP_KEEPALIVE)
-				optval = 20;
-				(void)setsockopt(*sock, IPPROTO_TCP, TCP_KEEPALIVE, (const char*)&optval, optlen);
-#elif defined(TCP_KEEPIDLE)
-				optval = 20;
-				(void)setsockopt(*sock, IPPROTO_TCP, TCP_KEEPIDLE, (const char*)&optval, optlen);
-#endif
-
-#if defined(TCP_KEEPINTVL)
-				optval = 1;
-				(void)setsockopt(*sock, IPPROTO_TCP, TCP_KEEPINTVL, (const char*)&optval, optlen);
-#endif
+static void zet017_convert_int32_scalar(const uint8_t* src, uint32_t step, float scale, float* dst, uint32_t count) {
+	for (uint32_t i = 0; i < count; ++i, src += step)
+		dst[i] = (float)(*(const int32_t*)src) * scale;
+}
 
-#if defined(TCP_KEEPCNT)
-				optval = 10;
-				(void)setsockopt(*sock, IPPROTO_TCP, TCP_KEEPCNT, (const char*)&optval, optlen);
-#endif
+#if defined(ZET017_TCP_X86)
+ZET017_TARGET("sse2")
+static void zet017_convert_int16_sse2(const uint8_t* src, uint32_t step, float scale, float* dst, uint32_t count) {
+	__m128 k = _mm_set1_ps(scale);
+	uint32_t i = 0;
+	if (step == sizeof(int16_t)) {
+		for (; i + 8 <= count; i += 8, src += 8 * sizeof(int16_t)) {
+			__m128i x = _mm_loadu_si128((const __m128i*)src);
+			__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+			__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+			_mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), k));
+			_mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), k));
+		}
+	}
+	else {
+		for (; i + 4 <= count; i += 4, src += 4 * step) {
+			__m128i x = _mm_setr_epi32(
+				*(const int16_t*)src, *(const int16_t*)(src + step),
+				*(const int16_t*)(src + 2 * step), *(const int16_t*)(src + 3 * step));
+			_mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(x), k));
+		}
+	}
+	zet017_convert_int16_scalar(src, step, scale, dst + i, count - i);
+}
 
-				return 0;
-			}
+ZET017_TARGET("sse2")
+static void zet017_convert_int32_sse2(const uint8_t* src, uint32_t step, float scale, float* dst, uint32_t count) {
+	__m128 k = _mm_set1_ps(scale);
+	uint32_t i = 0;
+	if (step == sizeof(int32_t)) {
+		for (; i + 4 <= count; i += 4, src += 4 * sizeof(int32_t)) {
+			__m128i x = _mm_loadu_si128((const __m128i*)src);
+			_mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(x), k));
 		}
-		if (FD_ISSET(device->wakeup_socket[1], &rfds)) {
-			char buf;
-			recv(device->wakeup_socket[1], &buf, 1, 0);
+	}
+	else {
+		for (; i + 4 <= count; i += 4, src += 4 * step) {
+			__m128i x = _mm_setr_epi32(
+				*(const int32_t*)src, *(const int32_t*)(src + step),
+				*(const int32_t*)(src + 2 * step), *(const int32_t*)(src + 3 * step));
+			_mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(x), k));
 		}
 	}
+	zet017_convert_int32_scalar(src, step, scale, dst + i, count - i);
+}
 
-	return -1;
+ZET017_TARGET("avx2")
+static void zet017_convert_int16_avx2(const uint8_t* src, uint32_t step, float scale, float* dst, uint32_t count) {
+	__m256 k = _mm256_set1_ps(scale);
+	uint32_t i = 0;
+	if (step == sizeof(int16_t)) {
+		for (; i + 8 <= count; i += 8, src += 8 * sizeof(int16_t)) {
+			__m256i x = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)src));
+			_mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(x), k));
+		}
+	}
+	else {
+		for (; i + 8 <= count; i += 8, src += 8 * step) {
+			__m256i x = _mm256_setr_epi32(
+				*(const int16_t*)src, *(const int16_t*)(src + step),
+				*(const int16_t*)(src + 2 * step), *(const int16_t*)(src + 3 * step),
+				*(const int16_t*)(src + 4 * step), *(const int16_t*)(src + 5 * step),
+				*(const int16_t*)(src + 6 * step), *(const int16_t*)(src + 7 * step));
+			_mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(x), k));
+		}
+	}
+	zet017_convert_int16_scalar(src, step, scale, dst + i, count - i);
 }
 
-static int zet017_socket_handshake(struct zet017_device* device, socket_t* sock) {
-	uint32_t flush_size = 0;
-	char flush_data[ZET017_MAX_FLUSH_SIZE + sizeof(flush_size)];
-	int flush_data_ptr = 0;
+ZET017_TARGET("avx2")
+static void zet017_convert_int32_avx2(const uint8_t* src, uint32_t step, float scale, float* dst, uint32_t count) {
+	__m256 k = _mm256_set1_ps(scale);
+	uint32_t i = 0;
+	if (step == sizeof(int32_t)) {
+		for (; i + 8 <= count; i += 8, src += 8 * sizeof(int32_t)) {
+			__m256i x = _mm256_loadu_si256((const __m256i*)src);
+			_mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(x), k));
+		}
+	}
+	else {
+		for (; i + 8 <= count; i += 8, src += 8 * step) {
+			__m256i x = _mm256_setr_epi32(
+				*(const int32_t*)src, *(const int32_t*)(src + step),
+				*(const int32_t*)(src + 2 * step), *(const int32_t*)(src + 3 * step),
+				*(const int32_t*)(src + 4 * step), *(const int32_t*)(src + 5 * step),
+				*(const int32_t*)(src + 6 * step), *(const int32_t*)(src + 7 * step));
+			_mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(x), k));
+		}
+	}
+	zet017_convert_int32_scalar(src, step, scale, dst + i, count - i);
+}
 
-	for (;;) {
-		fd_set rfds;
-		FD_ZERO(&rfds);
-		FD_SET(device->wakeup_socket[1], &rfds);
-		FD_SET(*sock, &rfds);
+// Deinterleave kernels read whole 8-channel frames, transpose them in registers and write
+// every channel at once, instead of walking the ring once per channel.
+static void zet017_deinterleave_int16_tail(const uint8_t* src, const float* scale, float* const* dst, uint32_t i, uint32_t count) {
+	for (uint32_t j = 0; j < ZET017_DEINTERLEAVE_CHANNELS; ++j)
+		zet017_convert_int16_scalar(src + j * sizeof(int16_t), ZET017_DEINTERLEAVE_CHANNELS * sizeof(int16_t),
+			scale[j], dst[j] + i, count - i);
+}
 
-		int nfds = (int)(*sock > device->wakeup_socket[1] ? *sock : device->wakeup_socket[1]);
+static void zet017_deinterleave_int32_tail(const uint8_t* src, const float* scale, float* const* dst, uint32_t i, uint32_t count) {
+	for (uint32_t j = 0; j < ZET017_DEINTERLEAVE_CHANNELS; ++j)
+		zet017_convert_int32_scalar(src + j * sizeof(int32_t), ZET017_DEINTERLEAVE_CHANNELS * sizeof(int32_t),
+			scale[j], dst[j] + i, count - i);
+}
 
-		struct timeval tv;
-		tv.tv_sec = 10;
-		tv.tv_usec = 0;
+// Transposes 8 frames of 8 int16 samples, row j of the result holds channel j.
+ZET017_TARGET("sse2")
+static ZET017_INLINE void zet017_transpose_int16_sse2(const uint8_t* src, __m128i* c) {
+	__m128i r0 = _mm_loadu_si128((const __m128i*)src);
+	__m128i r1 = _mm_loadu_si128((const __m128i*)(src + 16));
+	__m128i r2 = _mm_loadu_si128((const __m128i*)(src + 32));
+	__m128i r3 = _mm_loadu_si128((const __m128i*)(src + 48));
+	__m128i r4 = _mm_loadu_si128((const __m128i*)(src + 64));
+	__m128i r5 = _mm_loadu_si128((const __m128i*)(src + 80));
+	__m128i r6 = _mm_loadu_si128((const __m128i*)(src + 96));
+	__m128i r7 = _mm_loadu_si128((const __m128i*)(src + 112));
+	__m128i a0 = _mm_unpacklo_epi16(r0, r1);
+	__m128i a1 = _mm_unpackhi_epi16(r0, r1);
+	__m128i a2 = _mm_unpacklo_epi16(r2, r3);
+	__m128i a3 = _mm_unpackhi_epi16(r2, r3);
+	__m128i a4 = _mm_unpacklo_epi16(r4, r5);
+	__m128i a5 = _mm_unpackhi_epi16(r4, r5);
+	__m128i a6 = _mm_unpacklo_epi16(r6, r7);
+	__m128i a7 = _mm_unpackhi_epi16(r6, r7);
+	__m128i b0 = _mm_unpacklo_epi32(a0, a2);
+	__m128i b1 = _mm_unpackhi_epi32(a0, a2);
+	__m128i b2 = _mm_unpacklo_epi32(a1, a3);
+	__m128i b3 = _mm_unpackhi_epi32(a1, a3);
+	__m128i b4 = _mm_unpacklo_epi32(a4, a6);
+	__m128i b5 = _mm_unpackhi_epi32(a4, a6);
+	__m128i b6 = _mm_unpacklo_epi32(a5, a7);
+	__m128i b7 = _mm_unpackhi_epi32(a5, a7);
+	c[0] = _mm_unpacklo_epi64(b0, b4);
+	c[1] = _mm_unpackhi_epi64(b0, b4);
+	c[2] = _mm_unpacklo_epi64(b1, b5);
+	c[3] = _mm_unpackhi_epi64(b1, b5);
+	c[4] = _mm_unpacklo_epi64(b2, b6);
+	c[5] = _mm_unpackhi_epi64(b2, b6);
+	c[6] = _mm_unpacklo_epi64(b3, b7);
+	c[7] = _mm_unpackhi_epi64(b3, b7);
+}
 
-		int r = select(nfds + 1, &rfds, NULL, NULL, &tv);
-		if (r == -1 || r == 0)
-			break;
+ZET017_TARGET("sse2")
+static ZET017_INLINE void zet017_store_int16_sse2(__m128i x, float scale, float* dst) {
+	__m128 k = _mm_set1_ps(scale);
+	_mm_storeu_ps(dst, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16)), k));
+	_mm_storeu_ps(dst + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16)), k));
+}
 
-		if (FD_ISSET(device->wakeup_socket[1], &rfds)) {
-			char buf;
-			recv(device->wakeup_socket[1], &buf, 1, 0);
-			break;
-		}
+ZET017_TARGET("sse2")
+static void zet017_deinterleave_int16_sse2(const uint8_t* src, const float* scale, float* const* dst, uint32_t count) {
+	uint32_t i = 0;
+	for (; i + 8 <= count; i += 8, src += 8 * ZET017_DEINTERLEAVE_CHANNELS * sizeof(int16_t)) {
+		__m128i c[ZET017_DEINTERLEAVE_CHANNELS];
+		zet017_transpose_int16_sse2(src, c);
+		zet017_store_int16_sse2(c[0], scale[0], dst[0] + i);
+		zet017_store_int16_sse2(c[1], scale[1], dst[1] + i);
+		zet017_store_int16_sse2(c[2], scale[2], dst[2] + i);
+		zet017_store_int16_sse2(c[3], scale[3], dst[3] + i);
+		zet017_store_int16_sse2(c[4], scale[4], dst[4] + i);
+		zet017_store_int16_sse2(c[5], scale[5], dst[5] + i);
+		zet017_store_int16_sse2(c[6], scale[6], dst[6] + i);
+		zet017_store_int16_sse2(c[7], scale[7], dst[7] + i);
+	}
+	zet017_deinterleave_int16_tail(src, scale, dst, i, count);
+}
 
-		if (FD_ISSET(*sock, &rfds)) {
-			int len = sizeof(flush_data) - flush_data_ptr;
-			r = recv(*sock, flush_data + flush_data_ptr, len, 0);
-			if (r <= 0)
-				break;
+ZET017_TARGET("sse2")
+static ZET017_INLINE void zet017_transpose_int32_sse2(const uint8_t* src, const float* scale, float* const* dst, uint32_t i) {
+	__m128 r0 = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)src));
+	__m128 r1 = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(src + 32)));
+	__m128 r2 = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(src + 64)));
+	__m128 r3 = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(src + 96)));
+	_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+	_mm_storeu_ps(dst[0] + i, _mm_mul_ps(r0, _mm_set1_ps(scale[0])));
+	_mm_storeu_ps(dst[1] + i, _mm_mul_ps(r1, _mm_set1_ps(scale[1])));
+	_mm_storeu_ps(dst[2] + i, _mm_mul_ps(r2, _mm_set1_ps(scale[2])));
+	_mm_storeu_ps(dst[3] + i, _mm_mul_ps(r3, _mm_set1_ps(scale[3])));
+}
 
-			flush_data_ptr += r;
-			if (flush_data_ptr >= sizeof(flush_size)) {
-				flush_size = *(uint32_t*)(flush_data);
-				if (flush_data_ptr - sizeof(flush_size) == flush_size)
-					return 0;
-			}
-		}
+ZET017_TARGET("sse2")
+static void zet017_deinterleave_int32_sse2(const uint8_t* src, const float* scale, float* const* dst, uint32_t count) {
+	uint32_t i = 0;
+	for (; i + 4 <= count; i += 4, src += 4 * ZET017_DEINTERLEAVE_CHANNELS * sizeof(int32_t)) {
+		// Two 4x4 transposes, channels 0-3 and 4-7 of the same 4 frames.
+		zet017_transpose_int32_sse2(src, scale, dst, i);
+		zet017_transpose_int32_sse2(src + 4 * sizeof(int32_t), scale + 4, dst + 4, i);
 	}
-
-	return -1;
+	zet017_deinterleave_int32_tail(src, scale, dst, i, count);
 }
 
-static int zet017_socket_cmd_connect(struct zet017_device* device) {
-	for (;;) {
-		device->cmd_socket = zet017_socket_connect(device->ip, ZET017_CMD_PORT);
-		if (INVALID_SOCKET == device->cmd_socket)
-			break;
+// Transposes 8 frames of 8 converted samples, scales each channel and stores it.
+ZET017_TARGET("avx2")
+static ZET017_INLINE void zet017_transpose_store_avx2(__m256 r0, __m256 r1, __m256 r2, __m256 r3,
+	__m256 r4, __m256 r5, __m256 r6, __m256 r7, const float* scale, float* const* dst, uint32_t i) {
+	__m256 t0 = _mm256_unpacklo_ps(r0, r1);
+	__m256 t1 = _mm256_unpackhi_ps(r0, r1);
+	__m256 t2 = _mm256_unpacklo_ps(r2, r3);
+	__m256 t3 = _mm256_unpackhi_ps(r2, r3);
+	__m256 t4 = _mm256_unpacklo_ps(r4, r5);
+	__m256 t5 = _mm256_unpackhi_ps(r4, r5);
+	__m256 t6 = _mm256_unpacklo_ps(r6, r7);
+	__m256 t7 = _mm256_unpackhi_ps(r6, r7);
+	__m256 s0 = _mm256_shuffle_ps(t0, t2, 0x44);
+	__m256 s1 = _mm256_shuffle_ps(t0, t2, 0xee);
+	__m256 s2 = _mm256_shuffle_ps(t1, t3, 0x44);
+	__m256 s3 = _mm256_shuffle_ps(t1, t3, 0xee);
+	__m256 s4 = _mm256_shuffle_ps(t4, t6, 0x44);
+	__m256 s5 = _mm256_shuffle_ps(t4, t6, 0xee);
+	__m256 s6 = _mm256_shuffle_ps(t5, t7, 0x44);
+	__m256 s7 = _mm256_shuffle_ps(t5, t7, 0xee);
+	_mm256_storeu_ps(dst[0] + i, _mm256_mul_ps(_mm256_permute2f128_ps(s0, s4, 0x20), _mm256_set1_ps(scale[0])));
+	_mm256_storeu_ps(dst[1] + i, _mm256_mul_ps(_mm256_permute2f128_ps(s1, s5, 0x20), _mm256_set1_ps(scale[1])));
+	_mm256_storeu_ps(dst[2] + i, _mm256_mul_ps(_mm256_permute2f128_ps(s2, s6, 0x20), _mm256_set1_ps(scale[2])));
+	_mm256_storeu_ps(dst[3] + i, _mm256_mul_ps(_mm256_permute2f128_ps(s3, s7, 0x20), _mm256_set1_ps(scale[3])));
+	_mm256_storeu_ps(dst[4] + i, _mm256_mul_ps(_mm256_permute2f128_ps(s0, s4, 0x31), _mm256_set1_ps(scale[4])));
+	_mm256_storeu_ps(dst[5] + i, _mm256_mul_ps(_mm256_permute2f128_ps(s1, s5, 0x31), _mm256_set1_ps(scale[5])));
+	_mm256_storeu_ps(dst[6] + i, _mm256_mul_ps(_mm256_permute2f128_ps(s2, s6, 0x31), _mm256_set1_ps(scale[6])));
+	_mm256_storeu_ps(dst[7] + i, _mm256_mul_ps(_mm256_permute2f128_ps(s3, s7, 0x31), _mm256_set1_ps(scale[7])));
+}
 
-		if (zet017_socket_wait_connect(device, &device->cmd_socket) != 0)
-			break;
+ZET017_TARGET("avx2")
+static ZET017_INLINE __m256 zet017_load_int16_avx2(const uint8_t* src) {
+	return _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)src)));
+}
 
-		if (zet017_socket_handshake(device, &device->cmd_socket) != 0)
-			break;
+ZET017_TARGET("avx2")
+static ZET017_INLINE __m256 zet017_load_int32_avx2(const uint8_t* src) {
+	return _mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i*)src));
+}
 
-		return 0;
+ZET017_TARGET("avx2")
+static void zet017_deinterleave_int16_avx2(const uint8_t* src, const float* scale, float* const* dst, uint32_t count) {
+	uint32_t i = 0;
+	for (; i + 8 <= count; i += 8, src += 8 * ZET017_DEINTERLEAVE_CHANNELS * sizeof(int16_t)) {
+		zet017_transpose_store_avx2(
+			zet017_load_int16_avx2(src), zet017_load_int16_avx2(src + 16),
+			zet017_load_int16_avx2(src + 32), zet017_load_int16_avx2(src + 48),
+			zet017_load_int16_avx2(src + 64), zet017_load_int16_avx2(src + 80),
+			zet017_load_int16_avx2(src + 96), zet017_load_int16_avx2(src + 112), scale, dst, i);
 	}
-
-	return -1;
+	zet017_deinterleave_int16_tail(src, scale, dst, i, count);
 }
 
-static int zet017_socket_adc_connect(struct zet017_device* device) {
-	for (;;) {
-		device->adc_socket = zet017_socket_connect(device->ip, ZET017_ADC_PORT);
-		if (INVALID_SOCKET == device->adc_socket)
-			break;
-
-		if (zet017_socket_wait_connect(device, &device->adc_socket) != 0)
-			break;
+ZET017_TARGET("avx2")
+static void zet017_deinterleave_int32_avx2(const uint8_t* src, const float* scale, float* const* dst, uint32_t count) {
+	uint32_t i = 0;
+	for (; i + 8 <= count; i += 8, src += 8 * ZET017_DEINTERLEAVE_CHANNELS * sizeof(int32_t)) {
+		zet017_transpose_store_avx2(
+			zet017_load_int32_avx2(src), zet017_load_int32_avx2(src + 32),
+			zet017_load_int32_avx2(src + 64), zet017_load_int32_avx2(src + 96),
+			zet017_load_int32_avx2(src + 128), zet017_load_int32_avx2(src + 160),
+			zet017_load_int32_avx2(src + 192), zet017_load_int32_avx2(src + 224), scale, dst, i);
+	}
+	zet017_deinterleave_int32_tail(src, scale, dst, i, count);
+}
 
-		if (zet017_socket_handshake(device, &device->adc_socket) != 0)
-			break;
+ZET017_TARGET("sse2")
+static __m128i zet017_quantize_sse2(const float* src, __m128 k, __m128 min, __m128 max) {
+	__m128 x = _mm_mul_ps(_mm_loadu_ps(src), k);
+	x = _mm_and_ps(x, _mm_cmpord_ps(x, x));
+	return _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(x, min), max));
+}
 
-		return 0;
+ZET017_TARGET("sse2")
+static void zet017_quantize_int16_sse2(const float* src, float scale, uint8_t* dst, uint32_t step, uint32_t count) {
+	__m128 k = _mm_set1_ps(scale);
+	__m128 min = _mm_set1_ps(ZET017_QUANTIZE_INT16_MIN);
+	__m128 max = _mm_set1_ps(ZET017_QUANTIZE_INT16_MAX);
+	uint32_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m128i x = _mm_packs_epi32(zet017_quantize_sse2(src + i, k, min, max), zet017_quantize_sse2(src + i + 4, k, min, max));
+		if (step == sizeof(int16_t)) {
+			_mm_storeu_si128((__m128i*)dst, x);
+			dst += 8 * sizeof(int16_t);
+		}
+		else {
+			*(int16_t*)dst = (int16_t)_mm_extract_epi16(x, 0);
+			*(int16_t*)(dst + step) = (int16_t)_mm_extract_epi16(x, 1);
+			*(int16_t*)(dst + 2 * step) = (int16_t)_mm_extract_epi16(x, 2);
+			*(int16_t*)(dst + 3 * step) = (int16_t)_mm_extract_epi16(x, 3);
+			*(int16_t*)(dst + 4 * step) = (int16_t)_mm_extract_epi16(x, 4);
+			*(int16_t*)(dst + 5 * step) = (int16_t)_mm_extract_epi16(x, 5);
+			*(int16_t*)(dst + 6 * step) = (int16_t)_mm_extract_epi16(x, 6);
+			*(int16_t*)(dst + 7 * step) = (int16_t)_mm_extract_epi16(x, 7);
+			dst += 8 * step;
+		}
 	}
+	zet017_quantize_int16_scalar(src + i, scale, dst, step, count - i);
+}
 
-	return -1;
+ZET017_TARGET("sse2")
+static void zet017_quantize_int32_sse2(const float* src, float scale, uint8_t* dst, uint32_t step, uint32_t count) {
+	__m128 k = _mm_set1_ps(scale);
+	__m128 min = _mm_set1_ps(ZET017_QUANTIZE_INT32_MIN);
+	__m128 max = _mm_set1_ps(ZET017_QUANTIZE_INT32_MAX);
+	uint32_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128i x = zet017_quantize_sse2(src + i, k, min, max);
+		if (step == sizeof(int32_t)) {
+			_mm_storeu_si128((__m128i*)dst, x);
+			dst += 4 * sizeof(int32_t);
+		}
+		else {
+			*(int32_t*)dst = _mm_cvtsi128_si32(x);
+			*(int32_t*)(dst + step) = _mm_cvtsi128_si32(_mm_shuffle_epi32(x, 0x55));
+			*(int32_t*)(dst + 2 * step) = _mm_cvtsi128_si32(_mm_shuffle_epi32(x, 0xaa));
+			*(int32_t*)(dst + 3 * step) = _mm_cvtsi128_si32(_mm_shuffle_epi32(x, 0xff));
+			dst += 4 * step;
+		}
+	}
+	zet017_quantize_int32_scalar(src + i, scale, dst, step, count - i);
 }
 
-static int zet017_socket_dac_connect(struct zet017_device* device) {
-	for (;;) {
-		device->dac_socket = zet017_socket_connect(device->ip, ZET017_DAC_PORT);
-		if (INVALID_SOCKET == device->dac_socket)
-			break;
+ZET017_TARGET("sse2")
+static void zet017_interleave_int16_sse2(
+	const float* src0, float scale0, const float* src1, float scale1, uint8_t* dst, uint32_t count) {
+	__m128 k0 = _mm_set1_ps(scale0);
+	__m128 k1 = _mm_set1_ps(scale1);
+	__m128 min = _mm_set1_ps(ZET017_QUANTIZE_INT16_MIN);
+	__m128 max = _mm_set1_ps(ZET017_QUANTIZE_INT16_MAX);
+	uint32_t i = 0;
+	for (; i + 4 <= count; i += 4, dst += 4 * 2 * sizeof(int16_t)) {
+		__m128i x0 = zet017_quantize_sse2(src0 + i, k0, min, max);
+		__m128i x1 = zet017_quantize_sse2(src1 + i, k1, min, max);
+		_mm_storeu_si128((__m128i*)dst, _mm_packs_epi32(_mm_unpacklo_epi32(x0, x1), _mm_unpackhi_epi32(x0, x1)));
+	}
+	zet017_interleave_int16_scalar(src0 + i, scale0, src1 + i, scale1, dst, count - i);
+}
 
-		if (zet017_socket_wait_connect(device, &device->dac_socket) != 0)
-			break;
+ZET017_TARGET("sse2")
+static void zet017_interleave_int32_sse2(
+	const float* src0, float scale0, const float* src1, float scale1, uint8_t* dst, uint32_t count) {
+	__m128 k0 = _mm_set1_ps(scale0);
+	__m128 k1 = _mm_set1_ps(scale1);
+	__m128 min = _mm_set1_ps(ZET017_QUANTIZE_INT32_MIN);
+	__m128 max = _mm_set1_ps(ZET017_QUANTIZE_INT32_MAX);
+	uint32_t i = 0;
+	for (; i + 4 <= count; i += 4, dst += 4 * 2 * sizeof(int32_t)) {
+		__m128i x0 = zet017_quantize_sse2(src0 + i, k0, min, max);
+		__m128i x1 = zet017_quantize_sse2(src1 + i, k1, min, max);
+		_mm_storeu_si128((__m128i*)dst, _mm_unpacklo_epi32(x0, x1));
+		_mm_storeu_si128((__m128i*)(dst + 4 * sizeof(int32_t)), _mm_unpackhi_epi32(x0, x1));
+	}
+	zet017_interleave_int32_scalar(src0 + i, scale0, src1 + i, scale1, dst, count - i);
+}
 
-		if (zet017_socket_handshake(device, &device->dac_socket) != 0)
-			break;
+static int zet017_cpu_has_sse2(void) {
+#if defined(_M_X64) || defined(__x86_64__)
+	return 1;
+#elif defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 1);
+	return (info[3] & (1 << 26)) != 0;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sse2");
+#endif
+}
 
+static int zet017_cpu_has_avx2(void) {
+#if defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
 		return 0;
-	}
-
-	return -1;
+	__cpuid(info, 1);
+	if (!(info[2] & (1 << 27)) || !(info[2] & (1 << 28)))
+		return 0;
+	if ((_xgetbv(0) & 0x6) != 0x6)
+		return 0;
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+#endif
 }
+#endif
 
-static void zet017_wakeup_socket_cleanup(struct zet017_device* device) {
-	if (device->wakeup_socket[0] != INVALID_SOCKET) {
-		close_socket(device->wakeup_socket[0]);
-		device->wakeup_socket[0] = INVALID_SOCKET;
+#if defined(ZET017_TCP_NEON)
+static void zet017_convert_int16_neon(const uint8_t* src, uint32_t step, float scale, float* dst, uint32_t count) {
+	uint32_t i = 0;
+	if (step == sizeof(int16_t)) {
+		for (; i + 8 <= count; i += 8, src += 8 * sizeof(int16_t)) {
+			int16x8_t x = vld1q_s16((const int16_t*)src);
+			vst1q_f32(dst + i, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(x))), scale));
+			vst1q_f32(dst + i + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(x))), scale));
+		}
 	}
-	if (device->wakeup_socket[1] != INVALID_SOCKET) {
-		close_socket(device->wakeup_socket[1]);
-		device->wakeup_socket[1] = INVALID_SOCKET;
+	else {
+		for (; i + 4 <= count; i += 4, src += 4 * step) {
+			int32x4_t x = vdupq_n_s32(0);
+			x = vsetq_lane_s32(*(const int16_t*)src, x, 0);
+			x = vsetq_lane_s32(*(const int16_t*)(src + step), x, 1);
+			x = vsetq_lane_s32(*(const int16_t*)(src + 2 * step), x, 2);
+			x = vsetq_lane_s32(*(const int16_t*)(src + 3 * step), x, 3);
+			vst1q_f32(dst + i, vmulq_n_f32(vcvtq_f32_s32(x), scale));
+		}
 	}
+	zet017_convert_int16_scalar(src, step, scale, dst + i, count - i);
 }
 
-static int zet017_wakeup_socket_init(struct zet017_device* device) {
-#if defined(ZET017_TCP_WINDOWS)
-	socket_t listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-	if (listener == INVALID_SOCKET)
-		return -1;
-
-	for (;;) {
-		int optval = 1;
-		int optlen = sizeof(optval);
-		(void)setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, (char*)&optval, optlen);
+static void zet017_convert_int32_neon(const uint8_t* src, uint32_t step, float scale, float* dst, uint32_t count) {
+	uint32_t i = 0;
+	if (step == sizeof(int32_t)) {
+		for (; i + 4 <= count; i += 4, src += 4 * sizeof(int32_t))
+			vst1q_f32(dst + i, vmulq_n_f32(vcvtq_f32_s32(vld1q_s32((const int32_t*)src)), scale));
+	}
+	else {
+		for (; i + 4 <= count; i += 4, src += 4 * step) {
+			int32x4_t x = vdupq_n_s32(0);
+			x = vsetq_lane_s32(*(const int32_t*)src, x, 0);
+			x = vsetq_lane_s32(*(const int32_t*)(src + step), x, 1);
+			x = vsetq_lane_s32(*(const int32_t*)(src + 2 * step), x, 2);
+			x = vsetq_lane_s32(*(const int32_t*)(src + 3 * step), x, 3);
+			vst1q_f32(dst + i, vmulq_n_f32(vcvtq_f32_s32(x), scale));
+		}
+	}
+	zet017_convert_int32_scalar(src, step, scale, dst + i, count - i);
+}
 
-		struct sockaddr_in addr;
-		memset(&addr, 0, sizeof(addr));
-		addr.sin_family = AF_INET;
-		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
-		addr.sin_port = 0;
-		if (bind(listener, (struct sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR)
-			break;
+#if defined(__aarch64__) || defined(_M_ARM64)
+// vcvtnq rounds to nearest and saturates, NaN converts to 0.
+static void zet017_quantize_int16_neon(const float* src, float scale, uint8_t* dst, uint32_t step, uint32_t count) {
+	uint32_t i = 0;
+	if (step == sizeof(int16_t)) {
+		for (; i + 8 <= count; i += 8, dst += 8 * sizeof(int16_t)) {
+			int32x4_t lo = vcvtnq_s32_f32(vmulq_n_f32(vld1q_f32(src + i), scale));
+			int32x4_t hi = vcvtnq_s32_f32(vmulq_n_f32(vld1q_f32(src + i + 4), scale));
+			vst1q_s16((int16_t*)dst, vcombine_s16(vqmovn_s32(lo), vqmovn_s32(hi)));
+		}
+	}
+	zet017_quantize_int16_scalar(src + i, scale, dst, step, count - i);
+}
 
-		memset(&addr, 0, sizeof(addr));
-		socklen_t addrlen = sizeof(addr);
-		if (getsockname(listener, (struct sockaddr*)&addr, &addrlen) == SOCKET_ERROR)
-			break;
+static void zet017_quantize_int32_neon(const float* src, float scale, uint8_t* dst, uint32_t step, uint32_t count) {
+	uint32_t i = 0;
+	if (step == sizeof(int32_t)) {
+		for (; i + 4 <= count; i += 4, dst += 4 * sizeof(int32_t))
+			vst1q_s32((int32_t*)dst, vcvtnq_s32_f32(vmulq_n_f32(vld1q_f32(src + i), scale)));
+	}
+	zet017_quantize_int32_scalar(src + i, scale, dst, step, count - i);
+}
 
-		addr.sin_family = AF_INET;
-		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
-		if (listen(listener, 1) == SOCKET_ERROR)
-			break;
+static void zet017_interleave_int16_neon(
+	const float* src0, float scale0, const float* src1, float scale1, uint8_t* dst, uint32_t count) {
+	uint32_t i = 0;
+	for (; i + 4 <= count; i += 4, dst += 4 * 2 * sizeof(int16_t)) {
+		int16x4x2_t x;
+		x.val[0] = vqmovn_s32(vcvtnq_s32_f32(vmulq_n_f32(vld1q_f32(src0 + i), scale0)));
+		x.val[1] = vqmovn_s32(vcvtnq_s32_f32(vmulq_n_f32(vld1q_f32(src1 + i), scale1)));
+		vst2_s16((int16_t*)dst, x);
+	}
+	zet017_interleave_int16_scalar(src0 + i, scale0, src1 + i, scale1, dst, count - i);
+}
 
-		device->wakeup_socket[0] = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-		if (device->wakeup_socket[0] == INVALID_SOCKET)
-			break;
+static void zet017_interleave_int32_neon(
+	const float* src0, float scale0, const float* src1, float scale1, uint8_t* dst, uint32_t count) {
+	uint32_t i = 0;
+	for (; i + 4 <= count; i += 4, dst += 4 * 2 * sizeof(int32_t)) {
+		int32x4x2_t x;
+		x.val[0] = vcvtnq_s32_f32(vmulq_n_f32(vld1q_f32(src0 + i), scale0));
+		x.val[1] = vcvtnq_s32_f32(vmulq_n_f32(vld1q_f32(src1 + i), scale1));
+		vst2q_s32((int32_t*)dst, x);
+	}
+	zet017_interleave_int32_scalar(src0 + i, scale0, src1 + i, scale1, dst, count - i);
+}
+#endif
+#endif
 
-		if (connect(device->wakeup_socket[0], (struct sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR)
-			break;
+static struct zet017_convert_kernels zet017_convert = {
+	zet017_convert_int16_scalar,
+	zet017_convert_int32_scalar,
+	zet017_quantize_int16_scalar,
+	zet017_quantize_int32_scalar,
+	zet017_interleave_int16_scalar,
+	zet017_interleave_int32_scalar,
+	NULL,
+	NULL,
+};
 
-		device->wakeup_socket[1] = accept(listener, NULL, NULL);
-		if (device->wakeup_socket[1] == INVALID_SOCKET)
-			break;
+static void zet017_convert_init(void) {
+#if defined(ZET017_TCP_X86)
+	// Quantization is bound by the strided stores, AVX2 adds nothing over SSE2 there.
+	if (zet017_cpu_has_sse2()) {
+		zet017_convert.int16 = zet017_convert_int16_sse2;
+		zet017_convert.int32 = zet017_convert_int32_sse2;
+		zet017_convert.quantize_int16 = zet017_quantize_int16_sse2;
+		zet017_convert.quantize_int32 = zet017_quantize_int32_sse2;
+		zet017_convert.interleave_int16 = zet017_interleave_int16_sse2;
+		zet017_convert.interleave_int32 = zet017_interleave_int32_sse2;
+		zet017_convert.deinterleave_int16 = zet017_deinterleave_int16_sse2;
+		zet017_convert.deinterleave_int32 = zet017_deinterleave_int32_sse2;
+	}
+	if (zet017_cpu_has_avx2()) {
+		zet017_convert.int16 = zet017_convert_int16_avx2;
+		zet017_convert.int32 = zet017_convert_int32_avx2;
+		zet017_convert.deinterleave_int16 = zet017_deinterleave_int16_avx2;
+		zet017_convert.deinterleave_int32 = zet017_deinterleave_int32_avx2;
+	}
+#elif defined(ZET017_TCP_NEON)
+	zet017_convert.int16 = zet017_convert_int16_neon;
+	zet017_convert.int32 = zet017_convert_int32_neon;
+#if defined(__aarch64__) || defined(_M_ARM64)
+	zet017_convert.quantize_int16 = zet017_quantize_int16_neon;
+	zet017_convert.quantize_int32 = zet017_quantize_int32_neon;
+	zet017_convert.interleave_int16 = zet017_interleave_int16_neon;
+	zet017_convert.interleave_int32 = zet017_interleave_int32_neon;
+#endif
+#endif
+}
 
-		closesocket(listener);
+// The kernel table is process-wide, it is filled once before any server can read through it.
+#if defined(ZET017_TCP_WINDOWS)
+static INIT_ONCE zet017_convert_once = INIT_ONCE_STATIC_INIT;
+
+static BOOL CALLBACK zet017_convert_init_once(PINIT_ONCE once, PVOID parameter, PVOID* context) {
+	(void)once;
+	(void)parameter;
+	(void)context;
+	zet017_convert_init();
+	return TRUE;
+}
+#else
+static pthread_once_t zet017_convert_once = PTHREAD_ONCE_INIT;
+#endif
 
-		return 0;
-	}
-	closesocket(listener);
+static void zet017_convert_setup(void) {
+#if defined(ZET017_TCP_WINDOWS)
+	InitOnceExecuteOnce(&zet017_convert_once, zet017_convert_init_once, NULL, NULL);
 #else
-	if (socketpair(AF_LOCAL, SOCK_STREAM, 0, device->wakeup_socket) == 0)
-		return 0;
+	pthread_once(&zet017_convert_once, zet017_convert_init);
 #endif
+}
 
-	zet017_wakeup_socket_cleanup(device);
+static uint32_t zet017_hash_ip(const char* ip) {
+	uint32_t hash = 2166136261u;
+	while (*ip != '\0') {
+		hash ^= (uint8_t)*ip++;
+		hash *= 16777619u;
+	}
 
-	return -2;
+	return hash;
 }
 
-static void zet017_device_wakeup(struct zet017_device* device) {
-	char buf = 'x';
-	send(device->wakeup_socket[0], &buf, sizeof(buf), 0);
+static uint32_t zet017_hash_serial(uint32_t serial) {
+	return serial * 2654435761u;
 }
 
-static int zet017_device_process_wakeup(struct zet017_device* device) {
-	for (;;) {
-		fd_set rfds;
-		FD_ZERO(&rfds);
-		FD_SET(device->wakeup_socket[1], &rfds);
+static uint32_t zet017_hash_number(uint32_t number) {
+	return (number ^ 0x5bd1e995u) * 2654435761u;
+}
 
-		struct timeval tv;
-		tv.tv_sec = 0;
-		tv.tv_usec = 0;
+// Builds a snapshot of server->devices; called with devices_mutex held.
+static struct zet017_registry* zet017_registry_build(struct zet017_server* server) {
+	uint32_t count = (uint32_t)server->device_count;
+	uint32_t buckets = 8;
+	while (buckets < count * 2)
+		buckets <<= 1;
+
+	struct zet017_registry* registry = malloc(sizeof(struct zet017_registry) +
+		count * (sizeof(struct zet017_device*) + sizeof(uint32_t)) + 3 * buckets * sizeof(uint32_t));
+	if (!registry)
+		return NULL;
+
+	registry->count = count;
+	registry->mask = buckets - 1;
+	registry->devices = (struct zet017_device**)(registry + 1);
+	registry->serial = (uint32_t*)(registry->devices + count);
+	registry->by_number = registry->serial + count;
+	registry->by_ip = registry->by_number + buckets;
+	registry->by_serial = registry->by_ip + buckets;
+	registry->retired = NULL;
+	memset(registry->by_number, 0x0, 3 * buckets * sizeof(uint32_t));
+
+	// Serials read from here on are indexed; one reported meanwhile marks the snapshot stale again.
+	atomic_store_u32(&server->registry_stale, 0);
+	memory_fence();
+
+	// Hash slots hold the list position plus one, 0 marks an empty slot.
+	uint32_t index = 0;
+	for (struct zet017_device* device = server->devices; device != NULL; device = device->next, ++index) {
+		registry->devices[index] = device;
+
+		uint32_t slot = zet017_hash_number(device->number) & registry->mask;
+		while (registry->by_number[slot] != 0)
+			slot = (slot + 1) & registry->mask;
+		registry->by_number[slot] = index + 1;
+
+		slot = zet017_hash_ip(device->ip) & registry->mask;
+		while (registry->by_ip[slot] != 0)
+			slot = (slot + 1) & registry->mask;
+		registry->by_ip[slot] = index + 1;
+
+		mutex_lock(&device->info_mutex);
+		registry->serial[index] = device->info.serial;
+		mutex_unlock(&device->info_mutex);
+		if (registry->serial[index] != 0) {
+			slot = zet017_hash_serial(registry->serial[index]) & registry->mask;
+			while (registry->by_serial[slot] != 0)
+				slot = (slot + 1) & registry->mask;
+			registry->by_serial[slot] = index + 1;
+		}
+	}
 
-		int r = select((int)device->wakeup_socket[1] + 1, &rfds, NULL, NULL, &tv);
-		if (r == -1)
-			return -1;
+	return registry;
+}
 
-		if (r == 0)
-			return 0;
+// Publishes a fresh snapshot; called with devices_mutex held. The previous one is only retired here,
+// it is freed by zet017_registry_synchronize() once no reader can reach it anymore.
+static int zet017_registry_publish(struct zet017_server* server) {
+	struct zet017_registry* registry = zet017_registry_build(server);
+	if (!registry)
+		return -1;
 
-		if (FD_ISSET(device->wakeup_socket[1], &rfds)) {
-			char buf;
-			recv(device->wakeup_socket[1], &buf, 1, 0);
-		}
+	struct zet017_registry* previous = server->registry;
+	atomic_store_ptr((void* volatile*)&server->registry, registry);
+	if (previous != NULL) {
+		previous->retired = server->retired;
+		server->retired = previous;
 	}
 
 	return 0;
 }
 
-static void zet017_device_close(struct zet017_device* device) {
-	zet017_wakeup_socket_cleanup(device);
-	if (device->cmd_socket != INVALID_SOCKET) {
-		close_socket(device->cmd_socket);
-		device->cmd_socket = INVALID_SOCKET;
-	}
-	if (device->adc_socket != INVALID_SOCKET) {
-		close_socket(device->adc_socket);
-		device->adc_socket = INVALID_SOCKET;
+// Waits until every reader that entered before the call has left; called with devices_mutex held.
+// Devices unlinked and snapshots retired before the call may then be freed.
+static void zet017_registry_synchronize(struct zet017_server* server) {
+	uint32_t epoch = atomic_load_u32(&server->epoch) & 1;
+	atomic_store_u32(&server->epoch, epoch ^ 1);
+	while (atomic_load_u32(&server->readers[epoch].count) != 0)
+		thread_sleep(1);
+
+	while (server->retired != NULL) {
+		struct zet017_registry* retired = server->retired;
+		server->retired = retired->retired;
+		free(retired);
 	}
-	if (device->dac_socket != INVALID_SOCKET) {
-		close_socket(device->dac_socket);
-		device->dac_socket = INVALID_SOCKET;
+}
+
+static uint32_t zet017_registry_enter(struct zet017_server* server) {
+	if (!server)
+		return 0;
+
+	for (;;) {
+		uint32_t epoch = atomic_load_u32(&server->epoch) & 1;
+		atomic_add_u32(&server->readers[epoch].count, 1);
+		if ((atomic_load_u32(&server->epoch) & 1) == epoch)
+			return epoch;
+		atomic_add_u32(&server->readers[epoch].count, -1);
 	}
+}
 
-	device->is_connected = 0;
+static void zet017_registry_leave(struct zet017_server* server, uint32_t epoch) {
+	if (server)
+		atomic_add_u32(&server->readers[epoch].count, -1);
 }
 
-static void zet017_device_destroy(struct zet017_device* device) {
-	device->running = 0;
-	zet017_device_wakeup(device);
+// Refreshes the serial index after a device reported a new serial. The device thread must not wait
+// for devices_mutex, a writer may hold it while waiting for a reader that waits for this thread;
+// if it is busy, the snapshot stays marked stale and the next lookup that misses rebuilds it.
+static void zet017_registry_refresh(struct zet017_server* server) {
+	atomic_store_u32(&server->registry_stale, 1);
 #if defined(ZET017_TCP_WINDOWS)
-	WaitForSingleObject(device->work_thread, INFINITE);
-	CloseHandle(device->work_thread);
+	if (!TryEnterCriticalSection(&server->devices_mutex))
+		return;
 #else
-	pthread_join(device->work_thread, NULL);
+	if (pthread_mutex_trylock(&server->devices_mutex) != 0)
+		return;
 #endif
-	zet017_device_close(device);
-	mutex_destroy(&device->state_mutex);
-	mutex_destroy(&device->info_mutex);
-	mutex_destroy(&device->config_mutex);
-	mutex_destroy(&device->adc_data.mutex);
-	mutex_destroy(&device->dac_data.mutex);
-	mutex_destroy(&device->command.mutex);
-	cond_destroy(&device->command.cond);
-
-	free(device);
+	(void)zet017_registry_publish(server);
+	mutex_unlock(&server->devices_mutex);
 }
 
-static int zet017_device_wait_stop(struct zet017_device* device, union zet017_packet* packet) {
-	int counter = 0;
-	for (;;) {
-		fd_set rfds;
-		FD_ZERO(&rfds);
-		FD_SET(device->wakeup_socket[1], &rfds);
-		FD_SET(device->adc_socket, &rfds);
-
-		int nfds = (int)(device->adc_socket > device->wakeup_socket[1] ? device->adc_socket : device->wakeup_socket[1]);
-
-		struct timeval tv;
-		tv.tv_sec = 2;
-		tv.tv_usec = 0;
+// The lookups return the list position of the device in the snapshot, -1 if it is not there.
+static int zet017_registry_find_number(struct zet017_registry* registry, uint32_t number) {
+	if (registry == NULL)
+		return -1;
 
-		int r = select(nfds + 1, &rfds, NULL, NULL, &tv);
-		if (r == -1 || r == 0) {
-			zet017_device_close(device);
-			break;
-		}
+	for (uint32_t slot = zet017_hash_number(number) & registry->mask; registry->by_number[slot] != 0; slot = (slot + 1) & registry->mask) {
+		uint32_t index = registry->by_number[slot] - 1;
+		if (registry->devices[index]->number == number)
+			return (int)index;
+	}
 
-		if (r > 0) {
-			if (FD_ISSET(device->adc_socket, &rfds)) {
-				r = recv(device->adc_socket, packet->raw, sizeof(*packet), 0);
-				if (r <= 0) {
-					zet017_device_close(device);
-					break;
-				}
-				if (r == sizeof(*packet)) {
-					for (int i = 0; i < r; ++i) {
-						if (packet->raw[i] != 0)
-							break;
+	return -1;
+}
 
-						if (i == r - 1)
-							return 0;
-					}
-				}
-				if (++counter > 10) {
-					zet017_device_close(device);
-					break;
-				}
-			}
+static int zet017_registry_find_ip(struct zet017_registry* registry, const char* ip) {
+	if (registry == NULL)
+		return -1;
 
-			if (FD_ISSET(device->wakeup_socket[1], &rfds)) {
-				char buf;
-				if (recv(device->wakeup_socket[1], &buf, 1, 0) <= 0) {
-					zet017_device_close(device);
-					break;
-				}
-			}
-		}
+	for (uint32_t slot = zet017_hash_ip(ip) & registry->mask; registry->by_ip[slot] != 0; slot = (slot + 1) & registry->mask) {
+		uint32_t index = registry->by_ip[slot] - 1;
+		if (strcmp(registry->devices[index]->ip, ip) == 0)
+			return (int)index;
 	}
 
 	return -1;
 }
 
-static int zet017_device_process_command(struct zet017_device* device, union zet017_packet* packet) {
-	fd_set rfds;
-	FD_ZERO(&rfds);
-	FD_SET(device->wakeup_socket[1], &rfds);
+static int zet017_registry_find_serial(struct zet017_registry* registry, uint32_t serial) {
+	if (registry == NULL)
+		return -1;
 
-	fd_set wfds;
-	FD_ZERO(&wfds);
-	FD_SET(device->cmd_socket, &wfds);
+	for (uint32_t slot = zet017_hash_serial(serial) & registry->mask; registry->by_serial[slot] != 0; slot = (slot + 1) & registry->mask) {
+		uint32_t index = registry->by_serial[slot] - 1;
+		if (registry->serial[index] == serial)
+			return (int)index;
+	}
 
-	int nfds = (int)(device->cmd_socket > device->wakeup_socket[1] ? device->cmd_socket : device->wakeup_socket[1]);
+	return -1;
+}
 
-	struct timeval tv;
-	tv.tv_sec = 10;
-	tv.tv_usec = 0;
+// Only valid inside a reader section, see zet017_registry_enter().
+static struct zet017_device* zet017_get_device(struct zet017_server* server, uint32_t number) {
+	if (server) {
+		struct zet017_registry* registry = atomic_load_ptr((void* volatile*)&server->registry);
+		int index = zet017_registry_find_number(registry, number);
+		if (index >= 0)
+			return registry->devices[index];
+	}
+
+	return NULL;
+}
+
+static int zet017_socket_error(void) {
+#if defined(ZET017_TCP_WINDOWS)
+	return WSAGetLastError();
+#else
+	return errno;
+#endif
+}
+
+static int zet017_connect_fail(struct zet017_device* device, enum zet017_connect_error error, int system_error) {
+	device->connect.error = error;
+	device->connect.system_error = system_error;
+
+	return -1;
+}
+
+static socket_t zet017_socket_connect(const char* ip, unsigned short port) {
+	socket_t sock = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+	if (sock == INVALID_SOCKET)
+		return INVALID_SOCKET;
+
+	for (;;) {
+		struct sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		if (inet_pton(AF_INET, ip, &addr.sin_addr) <= 0)
+			break;
+		addr.sin_port = htons(port);
+
+#if defined(ZET017_TCP_WINDOWS)
+		u_long mode = 1;
+		if (ioctlsocket(sock, FIONBIO, &mode) != 0)
+#else
+		int mode = 1;
+		if (ioctl(sock, FIONBIO, &mode) < 0)
+#endif
+			break;
+
+		int r = connect(sock, (struct sockaddr*)&addr, sizeof(addr));
+		if (r == SOCKET_ERROR) {
+#if defined(ZET017_TCP_WINDOWS)
+			int r = WSAGetLastError();
+			if (r != WSAEWOULDBLOCK && r != WSAEINPROGRESS)
+#else
+			if (errno != EINPROGRESS)
+#endif
+				break;
+		}
+
+		return sock;
+	}
+
+	close_socket(sock);
+
+	return INVALID_SOCKET;
+}
+
+// Checks the outcome of a non-blocking connect and sets up keep-alive on success.
+static int zet017_socket_connected(socket_t sock, int* error) {
+	int optval = 0;
+	socklen_t optlen = sizeof(optval);
+	int r = getsockopt(sock, SOL_SOCKET, SO_ERROR, (char*)&optval, &optlen);
+	if (r != 0 || optval != 0) {
+		*error = r != 0 ? zet017_socket_error() : optval;
+		return -1;
+	}
+
+	optlen = sizeof(optval);
+	optval = 1;
+	(void)setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, (const char*)&optval, optlen);
+
+#if defined(TCP_KEEPALIVE)
+	optval = 20;
+	(void)setsockopt(sock, IPPROTO_TCP, TCP_KEEPALIVE, (const char*)&optval, optlen);
+#elif defined(TCP_KEEPIDLE)
+	optval = 20;
+	(void)setsockopt(sock, IPPROTO_TCP, TCP_KEEPIDLE, (const char*)&optval, optlen);
+#endif
+
+#if defined(TCP_KEEPINTVL)
+	optval = 1;
+	(void)setsockopt(sock, IPPROTO_TCP, TCP_KEEPINTVL, (const char*)&optval, optlen);
+#endif
+
+#if defined(TCP_KEEPCNT)
+	optval = 10;
+	(void)setsockopt(sock, IPPROTO_TCP, TCP_KEEPCNT, (const char*)&optval, optlen);
+#endif
+
+	return 0;
+}
+
+struct zet017_handshake {
+	uint32_t fill;
+	char data[ZET017_MAX_FLUSH_SIZE + sizeof(uint32_t)];
+};
+
+// A fresh connection starts with a size-prefixed block from the device that has to be read off.
+// Returns 1 once all of it is in, 0 while more is expected and -1 on error.
+static int zet017_socket_handshake(socket_t sock, struct zet017_handshake* handshake) {
+	int len = (int)(sizeof(handshake->data) - handshake->fill);
+	int r = recv(sock, handshake->data + handshake->fill, len, 0);
+	if (r <= 0)
+		return -1;
+
+	handshake->fill += (uint32_t)r;
+	if (handshake->fill >= sizeof(uint32_t)) {
+		uint32_t flush_size = *(uint32_t*)(handshake->data);
+		if (handshake->fill - sizeof(uint32_t) == flush_size)
+			return 1;
+	}
+	if (handshake->fill == sizeof(handshake->data))
+		return -1;
+
+	return 0;
+}
+
+// A signal is a descriptor pair that becomes readable once raised and stays so until drained:
+// an eventfd on Linux, where both ends are the same descriptor, and a non-blocking socket pair elsewhere.
+static void zet017_signal_close(socket_t* pair) {
+#if defined(ZET017_TCP_EVENTFD)
+	if (pair[1] != INVALID_SOCKET)
+		close(pair[1]);
+	pair[0] = pair[1] = INVALID_SOCKET;
+#else
+	if (pair[0] != INVALID_SOCKET) {
+		close_socket(pair[0]);
+		pair[0] = INVALID_SOCKET;
+	}
+	if (pair[1] != INVALID_SOCKET) {
+		close_socket(pair[1]);
+		pair[1] = INVALID_SOCKET;
+	}
+#endif
+}
+
+static int zet017_signal_open(socket_t* pair) {
+#if defined(ZET017_TCP_EVENTFD)
+	pair[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (pair[1] == -1)
+		return -2;
+
+	pair[0] = pair[1];
+
+	return 0;
+#elif defined(ZET017_TCP_WINDOWS)
+	socket_t listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (listener == INVALID_SOCKET)
+		return -1;
+
+	for (;;) {
+		int optval = 1;
+		int optlen = sizeof(optval);
+		(void)setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, (char*)&optval, optlen);
+
+		struct sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		addr.sin_port = 0;
+		if (bind(listener, (struct sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR)
+			break;
+
+		memset(&addr, 0, sizeof(addr));
+		socklen_t addrlen = sizeof(addr);
+		if (getsockname(listener, (struct sockaddr*)&addr, &addrlen) == SOCKET_ERROR)
+			break;
+
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		if (listen(listener, 1) == SOCKET_ERROR)
+			break;
+
+		pair[0] = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		if (pair[0] == INVALID_SOCKET)
+			break;
+
+		if (connect(pair[0], (struct sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR)
+			break;
+
+		pair[1] = accept(listener, NULL, NULL);
+		if (pair[1] == INVALID_SOCKET)
+			break;
+
+		// Both ends are non-blocking: a full pipe already means a signal is pending, and draining stops when empty.
+		u_long mode = 1;
+		if (ioctlsocket(pair[0], FIONBIO, &mode) != 0 || ioctlsocket(pair[1], FIONBIO, &mode) != 0)
+			break;
+
+		closesocket(listener);
+
+		return 0;
+	}
+	closesocket(listener);
+
+	zet017_signal_close(pair);
+
+	return -2;
+#else
+	if (socketpair(AF_LOCAL, SOCK_STREAM, 0, pair) == 0) {
+		int mode = 1;
+		if (ioctl(pair[0], FIONBIO, &mode) == 0 && ioctl(pair[1], FIONBIO, &mode) == 0)
+			return 0;
+	}
+
+	zet017_signal_close(pair);
+
+	return -2;
+#endif
+}
+
+static void zet017_signal_raise(socket_t* pair) {
+#if defined(ZET017_TCP_EVENTFD)
+	uint64_t value = 1;
+	(void)!write(pair[0], &value, sizeof(value));
+#else
+	char buf = 'x';
+	send(pair[0], &buf, sizeof(buf), 0);
+#endif
+}
+
+// Everything signalled so far is consumed at once; the eventfd counter resets in a single read.
+static int zet017_signal_drain(socket_t* pair) {
+#if defined(ZET017_TCP_EVENTFD)
+	uint64_t value;
+	if (read(pair[1], &value, sizeof(value)) < 0 && errno != EAGAIN && errno != EINTR)
+		return -1;
+#else
+	char buf[64];
+	int r;
+	while ((r = recv(pair[1], buf, sizeof(buf), 0)) == sizeof(buf))
+		;
+	if (r == 0)
+		return -1;
+#if defined(ZET017_TCP_WINDOWS)
+	if (r < 0 && zet017_socket_error() != WSAEWOULDBLOCK)
+#else
+	if (r < 0 && zet017_socket_error() != EAGAIN && zet017_socket_error() != EWOULDBLOCK && zet017_socket_error() != EINTR)
+#endif
+		return -1;
+#endif
+
+	return 0;
+}
+
+static void zet017_wakeup_socket_cleanup(struct zet017_device* device) {
+	zet017_events_detach(&device->events, zet017_event_wakeup);
+	zet017_signal_close(device->wakeup_socket);
+}
+
+static int zet017_wakeup_socket_init(struct zet017_device* device) {
+	if (zet017_signal_open(device->wakeup_socket) != 0)
+		return -2;
+
+	zet017_events_attach(&device->events, zet017_event_wakeup, device->wakeup_socket[1]);
+
+	return 0;
+}
+
+static void zet017_device_wakeup(struct zet017_device* device) {
+	zet017_signal_raise(device->wakeup_socket);
+}
+
+static int zet017_wakeup_drain(struct zet017_device* device) {
+	return zet017_signal_drain(device->wakeup_socket);
+}
+
+// Wakeups also announce new commands and settings, only a device being destroyed gives up the current wait.
+static int zet017_wakeup_abort(struct zet017_device* device) {
+	if (zet017_wakeup_drain(device) != 0)
+		return 1;
+
+	return !device->running;
+}
+
+// All three connections are opened at once and driven through connect and handshake together,
+// so a reconnect costs one round trip instead of three in a row.
+static int zet017_device_connect_sockets(struct zet017_device* device) {
+	socket_t* sockets[zet017_event_count] = { NULL, &device->cmd_socket, &device->adc_socket, &device->dac_socket };
+	const unsigned short ports[zet017_event_count] = { 0, ZET017_CMD_PORT, ZET017_ADC_PORT, ZET017_DAC_PORT };
+	struct zet017_handshake handshake[zet017_event_count];
+
+	uint32_t interest[zet017_event_count] = { 0 };
+	interest[zet017_event_wakeup] = ZET017_EVENT_READ;
+	for (uint32_t i = zet017_event_cmd; i <= zet017_event_dac; ++i) {
+		*sockets[i] = zet017_socket_connect(device->ip, ports[i]);
+		if (INVALID_SOCKET == *sockets[i])
+			return zet017_connect_fail(device, zet017_connect_error_connect, zet017_socket_error());
+
+		zet017_events_attach(&device->events, (enum zet017_event_source)i, *sockets[i]);
+		handshake[i].fill = 0;
+		interest[i] = ZET017_EVENT_WRITE;
+	}
+
+	uint32_t timeout = atomic_load_u32(&device->connect_timeout);
+	uint32_t start = zet017_get_timestamp();
+	uint32_t pending = zet017_event_dac - zet017_event_cmd + 1;
+	while (pending != 0) {
+		uint32_t elapsed = zet017_get_timestamp() - start;
+		if (elapsed >= timeout)
+			return zet017_connect_fail(device, zet017_connect_error_timeout, 0);
+
+		int r = zet017_events_wait(&device->events, interest, (int)(timeout - elapsed));
+		if (r == -1)
+			return zet017_connect_fail(device, zet017_connect_error_system, zet017_socket_error());
+		if (r == 0)
+			continue;
+
+		if ((device->events.ready[zet017_event_wakeup] & ZET017_EVENT_READ) && zet017_wakeup_abort(device))
+			return zet017_connect_fail(device, zet017_connect_error_aborted, 0);
+
+		for (uint32_t i = zet017_event_cmd; i <= zet017_event_dac; ++i) {
+			if (interest[i] & device->events.ready[i] & ZET017_EVENT_WRITE) {
+				int error = 0;
+				if (zet017_socket_connected(*sockets[i], &error) != 0)
+					return zet017_connect_fail(device, zet017_connect_error_connect, error);
+				interest[i] = ZET017_EVENT_READ;
+			}
+			else if (interest[i] & device->events.ready[i] & ZET017_EVENT_READ) {
+				r = zet017_socket_handshake(*sockets[i], &handshake[i]);
+				if (r < 0)
+					return zet017_connect_fail(device, zet017_connect_error_handshake, zet017_socket_error());
+				if (r > 0) {
+					interest[i] = 0;
+					--pending;
+				}
+			}
+		}
+	}
+
+	return 0;
+}
+
+// Ring buffers come zeroed. With ZET017_DEVICE_HUGEPAGES they are backed by huge pages when the system
+// has them reserved; *mapped is then the mapping length, 0 means an ordinary heap block.
+static uint8_t* zet017_ring_alloc(size_t size, uint32_t flags, size_t* mapped) {
+	if (flags & ZET017_DEVICE_HUGEPAGES) {
+#if defined(ZET017_TCP_WINDOWS)
+		SIZE_T page = GetLargePageMinimum();
+		if (page != 0) {
+			size_t length = (size + page - 1) / page * page;
+			void* data = VirtualAlloc(NULL, length, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+			if (data != NULL) {
+				*mapped = length;
+				return data;
+			}
+		}
+#else
+		size_t length = (size + ZET017_HUGEPAGE_SIZE - 1) / ZET017_HUGEPAGE_SIZE * ZET017_HUGEPAGE_SIZE;
+		void* data;
+#if defined(MAP_HUGETLB)
+		data = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (data != MAP_FAILED) {
+			*mapped = length;
+			return data;
+		}
+#endif
+#if defined(MADV_HUGEPAGE)
+		// No reserved huge pages, ask for transparent ones instead.
+		data = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (data != MAP_FAILED) {
+			(void)madvise(data, length, MADV_HUGEPAGE);
+			*mapped = length;
+			return data;
+		}
+#endif
+#endif
+	}
+
+	*mapped = 0;
+	return calloc(1, size);
+}
+
+static void zet017_ring_free(uint8_t* buffer, size_t mapped) {
+	if (mapped == 0)
+		free(buffer);
+	else {
+#if defined(ZET017_TCP_WINDOWS)
+		VirtualFree(buffer, 0, MEM_RELEASE);
+#else
+		munmap(buffer, mapped);
+#endif
+	}
+}
+
+static void zet017_device_free_buffers(struct zet017_device* device) {
+	while (device->adc_data.retired != NULL) {
+		struct zet017_retired_buffer* retired = device->adc_data.retired;
+		device->adc_data.retired = retired->next;
+		zet017_ring_free(retired->buffer, retired->mapped);
+		free(retired);
+	}
+	if (device->adc_data.ring.buffer != NULL)
+		zet017_ring_free(device->adc_data.ring.buffer, device->adc_data.mapped);
+	if (device->dac_data.buffer != NULL)
+		zet017_ring_free(device->dac_data.buffer, device->dac_data.mapped);
+	free(device->dac_data.stamp);
+}
+
+// Layout changes are published through a generation counter, odd while the worker rewrites the ring
+// description. Readers copy it and retry if a change overlapped the copy, so the worker never waits
+// for them. Replaced buffers are retired rather than freed, a copied buffer pointer stays valid.
+static void zet017_adc_ring_begin(struct zet017_adc_data* adc_data) {
+	atomic_store_u32(&adc_data->generation, adc_data->generation + 1);
+	memory_fence();
+}
+
+static void zet017_adc_ring_end(struct zet017_adc_data* adc_data) {
+	memory_fence();
+	atomic_store_u32(&adc_data->generation, adc_data->generation + 1);
+}
+
+static void zet017_adc_ring_read(struct zet017_adc_data* adc_data, struct zet017_adc_ring* ring) {
+	for (uint32_t round = 0;; ++round) {
+		uint32_t generation = atomic_load_u32(&adc_data->generation);
+		if (generation & 1) {
+			thread_backoff(round);
+			continue;
+		}
+
+		memcpy(ring, &adc_data->ring, sizeof(struct zet017_adc_ring));
+		memory_fence();
+		if (atomic_load_u32(&adc_data->generation) == generation)
+			return;
+	}
+}
+
+static void zet017_device_close(struct zet017_device* device) {
+	zet017_events_detach(&device->events, zet017_event_cmd);
+	if (device->cmd_socket != INVALID_SOCKET) {
+		close_socket(device->cmd_socket);
+		device->cmd_socket = INVALID_SOCKET;
+	}
+	zet017_events_detach(&device->events, zet017_event_adc);
+	if (device->adc_socket != INVALID_SOCKET) {
+		close_socket(device->adc_socket);
+		device->adc_socket = INVALID_SOCKET;
+	}
+	zet017_events_detach(&device->events, zet017_event_dac);
+	if (device->dac_socket != INVALID_SOCKET) {
+		close_socket(device->dac_socket);
+		device->dac_socket = INVALID_SOCKET;
+	}
+	device->receive.fill = 0;
+	device->receive.offset = 0;
+
+	device->is_connected = 0;
+}
+
+static void zet017_worker_remove_device(struct zet017_worker* worker, struct zet017_device* device) {
+	mutex_lock(&worker->mutex);
+
+	while (worker->current == device)
+		cond_wait(&worker->cond, &worker->mutex);
+
+	struct zet017_device** link = &worker->devices;
+	while (*link != NULL && *link != device)
+		link = &(*link)->worker_next;
+	if (*link != NULL) {
+		*link = device->worker_next;
+		--worker->device_count;
+	}
+#if defined(ZET017_TCP_EPOLL)
+	(void)epoll_ctl(worker->events_fd, EPOLL_CTL_DEL, device->events.fd, NULL);
+#endif
+
+	mutex_unlock(&worker->mutex);
+}
+
+static void zet017_request_release(struct zet017_request* request) {
+	mutex_lock(&request->mutex);
+	uint16_t refs = --request->refs;
+	mutex_unlock(&request->mutex);
+
+	if (refs == 0) {
+		mutex_destroy(&request->mutex);
+		cond_destroy(&request->cond);
+		free(request);
+	}
+}
+
+// Returns whether the group has been released; the first call for a request counts it as arrived.
+static int zet017_group_arrive(struct zet017_request* request) {
+	struct zet017_group* group = request->group;
+
+	mutex_lock(&group->mutex);
+	int released = group->released;
+	if (!request->arrived) {
+		request->arrived = 1;
+		if (++group->arrived == group->count)
+			cond_signal(&group->cond);
+	}
+	mutex_unlock(&group->mutex);
+
+	return released;
+}
+
+// The callback runs before waiters are released, so a wait that returns has seen it finish.
+static void zet017_request_complete(struct zet017_request* request, int result) {
+	// A group member that fails before it gets ready must not hold the others back.
+	if (request->group != NULL)
+		zet017_group_arrive(request);
+
+	if (request->callback != NULL)
+		request->callback(request->context, result);
+
+	mutex_lock(&request->mutex);
+	request->result = result;
+	request->completed = 1;
+	cond_broadcast(&request->cond);
+	mutex_unlock(&request->mutex);
+
+	zet017_request_release(request);
+}
+
+// Nothing else refers to the device any more, so the queue is walked without the lock.
+static void zet017_device_cancel_commands(struct zet017_device* device) {
+	while (device->command.head != NULL) {
+		struct zet017_request* request = device->command.head;
+		device->command.head = request->next;
+		zet017_request_complete(request, -1);
+	}
+	device->command.tail = NULL;
+}
+
+static int zet017_notify_enter(struct zet017_device* device) {
+	if (device == NULL)
+		return -1;
+
+	mutex_lock(&device->notify.mutex);
+	atomic_add_u32(&device->notify.waiters, 1);
+	mutex_unlock(&device->notify.mutex);
+
+	return 0;
+}
+
+static void zet017_notify_leave(struct zet017_device* device) {
+	mutex_lock(&device->notify.mutex);
+	atomic_add_u32(&device->notify.waiters, -1);
+	if (device->notify.closed)
+		cond_broadcast(&device->notify.cond);
+	mutex_unlock(&device->notify.mutex);
+}
+
+// Only called once the device is out of the registry, so no new waiter can arrive.
+static void zet017_notify_close(struct zet017_device* device) {
+	struct zet017_notify_data* notify = &device->notify;
+	if (atomic_load_u32(&notify->waiters) == 0)
+		return;
+
+	mutex_lock(&notify->mutex);
+	notify->closed = 1;
+	cond_broadcast(&notify->cond);
+	while (notify->waiters != 0)
+		cond_wait(&notify->cond, &notify->mutex);
+	mutex_unlock(&notify->mutex);
+}
+
+// Takes a device off the queue, or waits until the control thread that has it hands it back.
+static void zet017_control_cancel(struct zet017_control_pool* pool, struct zet017_device* device) {
+	mutex_lock(&pool->mutex);
+	for (uint32_t queue = 0; queue < 2; ++queue) {
+		struct zet017_device* previous = NULL;
+		for (struct zet017_device** link = &pool->head[queue]; *link != NULL; link = &(*link)->control_next) {
+			if (*link == device) {
+				*link = device->control_next;
+				if (pool->tail[queue] == device)
+					pool->tail[queue] = previous;
+				device->control_next = NULL;
+				atomic_store_u32(&device->control, zet017_control_idle);
+				break;
+			}
+			previous = *link;
+		}
+	}
+	while (atomic_load_u32(&device->control) == zet017_control_running)
+		cond_wait(&pool->done, &pool->mutex);
+	mutex_unlock(&pool->mutex);
+}
+
+static void zet017_device_destroy(struct zet017_device* device) {
+	zet017_notify_close(device);
+	if (device->worker != NULL) {
+		zet017_worker_remove_device(device->worker, device);
+		// A connect or command still in flight gives up at the wakeup.
+		device->running = 0;
+		if (atomic_load_u32(&device->control) != zet017_control_idle) {
+			zet017_device_wakeup(device);
+			zet017_control_cancel(&device->server->control, device);
+		}
+	}
+	else if (device->running) {
+		mutex_lock(&device->connect.mutex);
+		device->running = 0;
+		cond_signal(&device->connect.cond);
+		mutex_unlock(&device->connect.mutex);
+		zet017_device_wakeup(device);
+#if defined(ZET017_TCP_WINDOWS)
+		WaitForSingleObject(device->work_thread, INFINITE);
+		CloseHandle(device->work_thread);
+#else
+		pthread_join(device->work_thread, NULL);
+#endif
+	}
+	zet017_device_close(device);
+	zet017_wakeup_socket_cleanup(device);
+	zet017_events_cleanup(&device->events);
+	mutex_destroy(&device->state_mutex);
+	mutex_destroy(&device->info_mutex);
+	mutex_destroy(&device->config_mutex);
+	mutex_destroy(&device->dac_data.mutex);
+	mutex_destroy(&device->dac_data.callback_mutex);
+	mutex_destroy(&device->adc_data.callback_mutex);
+	zet017_device_cancel_commands(device);
+	mutex_destroy(&device->command.mutex);
+	mutex_destroy(&device->connect.mutex);
+	cond_destroy(&device->connect.cond);
+	zet017_signal_close(device->notify.signal);
+	mutex_destroy(&device->notify.mutex);
+	cond_destroy(&device->notify.cond);
+
+	zet017_device_free_buffers(device);
+	free(device->receive.buffer);
+	cache_aligned_free(device);
+}
+
+static void iovec_set(iovec_t* iov, void* data, uint32_t size) {
+#if defined(ZET017_TCP_WINDOWS)
+	iov->buf = (CHAR*)data;
+	iov->len = (ULONG)size;
+#else
+	iov->iov_base = data;
+	iov->iov_len = size;
+#endif
+}
+
+static int zet017_socket_readv(socket_t sock, iovec_t* iov, uint32_t count) {
+#if defined(ZET017_TCP_WINDOWS)
+	DWORD received = 0;
+	DWORD flags = 0;
+	if (WSARecv(sock, iov, count, &received, &flags, NULL, NULL) == SOCKET_ERROR)
+		return -1;
+	return (int)received;
+#else
+	return (int)readv(sock, iov, (int)count);
+#endif
+}
+
+static int zet017_socket_would_block(void) {
+#if defined(ZET017_TCP_WINDOWS)
+	return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+	return errno == EAGAIN || errno == EWOULDBLOCK;
+#endif
+}
+
+// Receives whatever the ADC socket holds into the staging buffer, at most until it is full.
+// Returns the number of bytes received, 0 if nothing was pending, -1 if the connection is lost.
+static int zet017_receive_adc(struct zet017_device* device) {
+	struct zet017_receive_data* receive = &device->receive;
+
+	uint32_t request = atomic_load_u32(&receive->request);
+	if (request != receive->size && request >= receive->fill) {
+		uint8_t* buffer = realloc(receive->buffer, request);
+		if (buffer != NULL) {
+			receive->buffer = buffer;
+			receive->size = request;
+		}
+	}
+
+	int r = recv(device->adc_socket, (char*)receive->buffer + receive->fill, receive->size - receive->fill, 0);
+	if (r < 0 && zet017_socket_would_block())
+		return 0;
+	if (r <= 0)
+		return -1;
+
+	receive->fill += r;
+
+	return r;
+}
+
+// Drops the complete packets from the head of the staging buffer, keeping a trailing partial one.
+static void zet017_receive_consume(struct zet017_device* device, uint32_t count) {
+	struct zet017_receive_data* receive = &device->receive;
+
+	uint32_t size = count * ZET017_PACKET_SIZE;
+	receive->fill -= size;
+	if (receive->fill != 0)
+		memmove(receive->buffer, receive->buffer + size, receive->fill);
+}
+
+// Scatters ADC packets from the socket straight into the ring: the data part of every packet lands
+// at its final place, the padding goes to a scratch area. A packet cut short by the read is finished
+// by the next call, its progress is kept in receive.offset. Returns the number of bytes received,
+// 0 if nothing was pending, -1 if the connection is lost.
+// This thread is the only writer of the ring, so nothing is locked: readers never wait for a receive.
+// They learn what the kernel may be overwriting from sequence_pending, and what is complete from sequence.
+static int zet017_receive_adc_direct(struct zet017_device* device, int* full) {
+	struct zet017_receive_data* receive = &device->receive;
+	uint32_t size = device->device_info.size_packet_adc * 2;
+
+	if (device->adc_data.ring.size == 0)
+		return -1;
+
+	uint32_t count = atomic_load_u32(&receive->request) / ZET017_PACKET_SIZE;
+	if (count > ZET017_RECEIVE_MAX_PACKETS)
+		count = ZET017_RECEIVE_MAX_PACKETS;
+	if ((uint64_t)count * size > device->adc_data.ring.size)
+		count = device->adc_data.ring.size / size;
+
+	// The batch never exceeds the ring, so its data crosses the wrap at most once.
+	iovec_t iov[2 * ZET017_RECEIVE_MAX_PACKETS + 1];
+	uint32_t n = 0;
+	uint32_t pointer = device->adc_data.pointer;
+	uint32_t offset = receive->offset;
+	for (uint32_t i = 0; i < count; ++i) {
+		if (offset < size) {
+			uint32_t position = pointer + offset;
+			if (position >= device->adc_data.ring.size)
+				position -= device->adc_data.ring.size;
+			uint32_t length = size - offset;
+			if (length > device->adc_data.ring.size - position) {
+				iovec_set(&iov[n++], device->adc_data.ring.buffer + position, device->adc_data.ring.size - position);
+				length -= device->adc_data.ring.size - position;
+				position = 0;
+			}
+			iovec_set(&iov[n++], device->adc_data.ring.buffer + position, length);
+			offset = size;
+		}
+		if (offset < ZET017_PACKET_SIZE)
+			iovec_set(&iov[n++], receive->padding + offset, ZET017_PACKET_SIZE - offset);
+
+		pointer += size;
+		if (pointer >= device->adc_data.ring.size)
+			pointer -= device->adc_data.ring.size;
+		offset = 0;
+	}
+
+	// The whole batch is claimed before the kernel writes into it.
+	uint64_t sequence = device->adc_data.sequence + (uint64_t)count * size;
+	if (sequence > device->adc_data.sequence_pending) {
+		atomic_store_u64(&device->adc_data.sequence_pending, sequence);
+		memory_fence();
+	}
+
+	int r = zet017_socket_readv(device->adc_socket, iov, n);
+	if (r <= 0) {
+		if (r < 0 && zet017_socket_would_block())
+			return 0;
+		return -1;
+	}
+
+	*full = (uint32_t)r == count * ZET017_PACKET_SIZE - receive->offset;
+
+	uint32_t total = receive->offset + (uint32_t)r;
+	uint32_t complete = total / ZET017_PACKET_SIZE;
+	receive->offset = total % ZET017_PACKET_SIZE;
+
+	if (complete != 0) {
+		if (device->adc_dac_data.adc_count == 0 && device->adc_dac_data.first_packet_time == 0)
+			atomic_store_u64(&device->adc_dac_data.first_packet_time, zet017_get_time_us());
+		device->adc_dac_data.adc_count +=
+			(uint64_t)complete * (size / device->adc_dac_data.work_channel_adc / device->adc_dac_data.sample_size_adc);
+
+		device->adc_data.pointer = (uint32_t)((device->adc_data.pointer + (uint64_t)complete * size) % device->adc_data.ring.size);
+		atomic_store_u64(&device->adc_data.sequence, device->adc_data.sequence + (uint64_t)complete * size);
+	}
+
+	return r;
+}
+
+// Moves a packet left half-received by zet017_receive_adc_direct() into the staging buffer,
+// so that the byte stream can be continued packet by packet from there.
+static void zet017_receive_realign(struct zet017_device* device) {
+	struct zet017_receive_data* receive = &device->receive;
+	if (receive->offset == 0)
+		return;
+
+	uint32_t size = device->device_info.size_packet_adc * 2;
+	uint32_t length = receive->offset < size ? receive->offset : size;
+
+	uint32_t pointer = device->adc_data.pointer;
+	if (length <= device->adc_data.ring.size - pointer)
+		memcpy(receive->buffer, device->adc_data.ring.buffer + pointer, length);
+	else {
+		uint32_t part = device->adc_data.ring.size - pointer;
+		memcpy(receive->buffer, device->adc_data.ring.buffer + pointer, part);
+		memcpy(receive->buffer + part, device->adc_data.ring.buffer, length - part);
+	}
+
+	if (receive->offset > size)
+		memcpy(receive->buffer + size, receive->padding + size, receive->offset - size);
+
+	receive->fill = receive->offset;
+	receive->offset = 0;
+}
+
+static int zet017_device_wait_stop(struct zet017_device* device) {
+	uint32_t interest[zet017_event_count] = { 0 };
+	interest[zet017_event_wakeup] = ZET017_EVENT_READ;
+	interest[zet017_event_adc] = ZET017_EVENT_READ;
+
+	zet017_receive_realign(device);
+
+	int counter = 0;
+	for (;;) {
+		int r = zet017_events_wait(&device->events, interest, 2000);
+		if (r == -1 || r == 0) {
+			zet017_device_close(device);
+			break;
+		}
+
+		if (r > 0) {
+			if (device->events.ready[zet017_event_adc] & ZET017_EVENT_READ) {
+				if (zet017_receive_adc(device) < 0) {
+					zet017_device_close(device);
+					break;
+				}
+
+				// Data still in flight before the stop is discarded, the stream ends with an all-zero packet.
+				uint32_t count = device->receive.fill / ZET017_PACKET_SIZE;
+				for (uint32_t j = 0; j < count; ++j) {
+					const uint8_t* data = device->receive.buffer + j * ZET017_PACKET_SIZE;
+					for (int i = 0; i < ZET017_PACKET_SIZE; ++i) {
+						if (data[i] != 0)
+							break;
+
+						if (i == ZET017_PACKET_SIZE - 1) {
+							device->receive.fill = 0;
+							return 0;
+						}
+					}
+				}
+				zet017_receive_consume(device, count);
+				if (++counter > 10) {
+					zet017_device_close(device);
+					break;
+				}
+			}
+
+			if ((device->events.ready[zet017_event_wakeup] & ZET017_EVENT_READ) && zet017_wakeup_abort(device)) {
+				zet017_device_close(device);
+				break;
+			}
+		}
+	}
+
+	return -1;
+}
+
+static int zet017_device_send_command(struct zet017_device* device, const union zet017_packet* packet) {
+	uint32_t interest[zet017_event_count] = { 0 };
+	interest[zet017_event_wakeup] = ZET017_EVENT_READ;
+	interest[zet017_event_cmd] = ZET017_EVENT_WRITE;
+
+	int r;
+	for (;;) {
+		r = zet017_events_wait(&device->events, interest, 10000);
+		if (r == -1 || r == 0)
+			return -1;
+
+		if ((device->events.ready[zet017_event_wakeup] & ZET017_EVENT_READ) && zet017_wakeup_abort(device))
+			return -2;
+
+		if (device->events.ready[zet017_event_cmd] & ZET017_EVENT_WRITE)
+			break;
+	}
+
+	r = send(device->cmd_socket, packet->raw, sizeof(*packet), 0);
+	if (r != sizeof(*packet))
+		return -2;
+
+	return 0;
+}
+
+// Replies come back in the order the commands were sent.
+static int zet017_device_receive_command(struct zet017_device* device, union zet017_packet* packet) {
+	uint32_t interest[zet017_event_count] = { 0 };
+	interest[zet017_event_wakeup] = ZET017_EVENT_READ;
+	interest[zet017_event_cmd] = ZET017_EVENT_READ;
+
+	int data_ptr = 0;
+	for (;;) {
+		int r = zet017_events_wait(&device->events, interest, 10000);
+		if (r == -1 || r == 0)
+			break;
+
+		if ((device->events.ready[zet017_event_wakeup] & ZET017_EVENT_READ) && zet017_wakeup_abort(device))
+			break;
+
+		if (device->events.ready[zet017_event_cmd] & ZET017_EVENT_READ) {
+			int len = sizeof(*packet) - data_ptr;
+			r = recv(device->cmd_socket, packet->raw + data_ptr, len, 0);
+			if (r <= 0)
+				break;
+
+			data_ptr += r;
+			if (data_ptr == sizeof(*packet))
+				return 0;
+		}
+	}
+
+	return -4;
+}
+
+static int zet017_device_process_command(struct zet017_device* device, union zet017_packet* packet) {
+	int r = zet017_device_send_command(device, packet);
+	if (r != 0)
+		return r;
+
+	return zet017_device_receive_command(device, packet);
+}
+
+static void zet017_device_update_buffer_size(struct zet017_device* device) {
+	mutex_lock(&device->state_mutex);
+	uint32_t sample_size = (uint32_t)(device->device_info.type_data_adc == 0 ? sizeof(int16_t) : sizeof(int32_t));
+	device->state.buffer_size_adc = device->adc_data.ring.size / sample_size;
+	if (device->device_info.work_channel_adc != 0)
+		device->state.buffer_size_adc /= device->device_info.work_channel_adc;
+	sample_size = (uint32_t)(device->device_info.type_data_dac == 0 ? sizeof(int16_t) : sizeof(int32_t));
+	device->state.buffer_size_dac = device->dac_data.size / sample_size;
+	if (device->device_info.work_channel_dac != 0)
+		device->state.buffer_size_dac /= device->device_info.work_channel_dac;
+	mutex_unlock(&device->state_mutex);
+}
+
+static void zet017_device_update_info(struct zet017_device* device, union zet017_packet* packet) {
+	memcpy(&device->device_info, &packet->info, sizeof(struct zet017_device_info));
+
+	device->adc_dac_data.sample_rate_adc = zet017_get_sample_rate_adc(device->device_info.mode_adc);
+	device->adc_dac_data.work_channel_adc = device->device_info.work_channel_adc;
+	device->adc_dac_data.sample_size_adc =
+		(uint16_t)(device->device_info.type_data_adc == 0 ? sizeof(int16_t) : sizeof(int32_t));
+	device->adc_dac_data.sample_rate_dac = zet017_get_sample_rate_dac(device->device_info.rate_dac);
+	device->adc_dac_data.work_channel_dac = device->device_info.work_channel_dac;
+	device->adc_dac_data.sample_size_dac =
+		(uint16_t)(device->device_info.type_data_dac == 0 ? sizeof(int16_t) : sizeof(int32_t));
+
+	mutex_lock(&device->info_mutex);
+	uint32_t serial = device->info.serial;
+	strcpy(device->info.name, device->device_info.device_name);
+	device->info.serial = device->device_info.serial;
+	strcpy(device->info.version, device->device_info.version_dsp);
+	mutex_unlock(&device->info_mutex);
+
+	if (serial != device->device_info.serial && device->server != NULL)
+		zet017_registry_refresh(device->server);
+
+	mutex_lock(&device->config_mutex);
+	device->config.sample_rate_adc = zet017_get_sample_rate_adc(device->device_info.mode_adc);
+	device->config.moda_adc = device->device_info.mode_adc;
+	device->config.sample_rate_dac = zet017_get_sample_rate_dac(device->device_info.rate_dac);
+	device->config.rate_dac = device->device_info.rate_dac;
+	device->config.mask_channel_adc = device->device_info.mask_channel_adc;
+	device->config.mask_icp = device->device_info.mask_icp;
+	for (uint32_t i = 0; i < 8; ++i) {
+		device->config.gain[i] = zet017_get_gain(device->device_info.amplify_code[i]);
+		device->config.gain_code[i] = device->device_info.amplify_code[i];
+	}
+	if (device->device_info.quantity_channel_adc == 4) {
+		device->config.mask_channel_adc =
+			((device->device_info.mask_channel_adc & 0x02) >> 1) +
+			((device->device_info.mask_channel_adc & 0x08) >> 2) +
+			((device->device_info.mask_channel_adc & 0x20) >> 3) +
+			((device->device_info.mask_channel_adc & 0x80) >> 4);
+		device->config.mask_icp =
+			((device->device_info.mask_icp & 0x02) >> 1) +
+			((device->device_info.mask_icp & 0x08) >> 2) +
+			((device->device_info.mask_icp & 0x20) >> 3) +
+			((device->device_info.mask_icp & 0x80) >> 4);
+		for (uint32_t i = 0; i < 4; ++i) {
+			device->config.gain[i] = zet017_get_gain(device->device_info.amplify_code[i * 2 + 1]);
+			device->config.gain_code[i] = device->device_info.amplify_code[i * 2 + 1];
+		}
+	}
+	device->config.builtin_dac_state = device->device_info.builtin_dac_state;
+	device->config.builtin_dac_sine_freq = (double)device->device_info.builtin_dac_sine_freq;
+	device->config.builtin_dac_sine_ampl = (double)device->device_info.builtin_dac_sine_ampl;
+	device->config.builtin_dac_sine_offset = (double)device->device_info.builtin_dac_sine_offset;
+	if (device->device_info.resolution_dac[0]) {
+		device->config.builtin_dac_sine_ampl *= device->device_info.resolution_dac[0];
+		device->config.builtin_dac_sine_offset *= device->device_info.resolution_dac[0];
+	}
+	else {
+		device->config.builtin_dac_sine_ampl *= device->device_info.resolution_dac_def;
+		device->config.builtin_dac_sine_offset *= device->device_info.resolution_dac_def;
+	}
+	mutex_unlock(&device->config_mutex);
+
+	zet017_device_update_buffer_size(device);
+}
+
+static void zet017_device_set_tenso_info(struct zet017_device* device, const void* tenso_info) {
+	memcpy(&device->tenso_info, tenso_info, sizeof(struct zet017_tenso_info));
+	for (uint32_t i = 0; i < 8; ++i) {
+		device->tenso_config.scheme[i] = (enum zet017_scheme)device->tenso_info.scheme[i];
+		device->tenso_config.correction_1[i] = device->tenso_info.correction[i][0];
+		device->tenso_config.correction_2[i] = device->tenso_info.correction[i][1];
+	}
+}
+
+static void zet017_device_update_tenso_info(struct zet017_device* device, union zet017_packet* packet) {
+	zet017_device_set_tenso_info(device, packet->cmd.data.u8);
+}
+
+static void zet017_device_update_adc_dac_info(struct zet017_device* device) {
+	zet017_adc_ring_begin(&device->adc_data);
+
+	device->adc_data.ring.channel_quantity = device->device_info.quantity_channel_adc;
+	device->adc_data.ring.work_channel = device->device_info.work_channel_adc;
+	device->adc_data.ring.channel_mask = device->device_info.mask_channel_adc;
+	device->adc_data.ring.sample_size = device->device_info.type_data_adc == 0 ? sizeof(int16_t) : sizeof(int32_t);
+	memcpy(device->adc_data.ring.amplify_code, device->device_info.amplify_code, sizeof(device->device_info.amplify_code));
+	if (device->device_info.quantity_channel_virt)
+		device->adc_data.ring.amplify_code[device->device_info.quantity_channel_adc - device->device_info.quantity_channel_virt] = 0;
+	if (device->device_info.quantity_channel_adc == 4) {
+		device->adc_data.ring.channel_mask =
+			((device->device_info.mask_channel_adc & 0x02) >> 1) +
+			((device->device_info.mask_channel_adc & 0x08) >> 2) +
+			((device->device_info.mask_channel_adc & 0x20) >> 3) +
+			((device->device_info.mask_channel_adc & 0x80) >> 4);
+		for (uint32_t i = 0; i < 4; ++i)
+			device->adc_data.ring.amplify_code[i] = device->device_info.amplify_code[i * 2 + 1];
+	}
+
+	uint16_t quantity_channel_adc = device->device_info.quantity_channel_adc - device->device_info.quantity_channel_virt;
+	for (uint32_t i = 0; i < quantity_channel_adc; ++i) {
+		uint32_t* dummy = (uint32_t*)device->correction.amplify[i];
+		if (*dummy == 0) {
+			float resolution = device->device_info.resolution_adc_def;
+			dummy = (uint32_t*)(device->device_info.resolution_adc + i);
+			if (quantity_channel_adc == 4)
+				dummy = (uint32_t*)(device->device_info.resolution_adc + i + i + 1);
+			if (*dummy != 0)
+				resolution = *(float*)dummy;
+			device->adc_data.ring.resolution[i][0] = resolution;
+			device->adc_data.ring.resolution[i][1] = resolution / 10.f;
+			device->adc_data.ring.resolution[i][2] = resolution / 100.f;
+		}
+		else {
+			device->adc_data.ring.resolution[i][0] = *(float*)dummy;
+			device->adc_data.ring.resolution[i][1] = device->adc_data.ring.resolution[i][0] / device->correction.amplify[i][1];
+			device->adc_data.ring.resolution[i][2] = device->adc_data.ring.resolution[i][0] / device->correction.amplify[i][2];
+		}
+	}
+	if (device->device_info.quantity_channel_virt)
+	{
+		uint32_t* dummy = (uint32_t*)(device->correction.reduction);
+		if (*dummy == 0) {
+			float resolution = device->device_info.resolution_dac_def;
+			dummy = (uint32_t*)(device->device_info.resolution_dac);
+			if (*dummy != 0)
+				resolution = *(float*)dummy;
+			device->adc_data.ring.resolution[quantity_channel_adc][0] = resolution;
+		}
+		else
+			device->adc_data.ring.resolution[quantity_channel_adc][0] = *(float*)dummy;
+	}
+
+	zet017_adc_ring_end(&device->adc_data);
+
+	mutex_lock(&device->dac_data.mutex);
+
+	device->dac_data.channel_quantity = device->device_info.work_channel_dac;
+	device->dac_data.channel_mask = device->device_info.mask_channel_dac;
+	device->dac_data.sample_size = device->device_info.type_data_dac == 0 ? sizeof(int16_t) : sizeof(int32_t);
+
+	uint16_t quantity_channel_dac = device->device_info.quantity_channel_dac;
+	for (uint32_t i = 0; i < quantity_channel_dac; ++i) {
+		uint32_t* dummy = (uint32_t*)(device->correction.reduction + i);
+		if (*dummy == 0) {
+			float resolution = device->device_info.resolution_dac_def;
+			dummy = (uint32_t*)(device->device_info.resolution_dac + i);
+			if (*dummy != 0)
+				resolution = *(float*)dummy;
+			device->dac_data.resolution[i] = resolution;
+		}
+		else
+			device->dac_data.resolution[i] = *(float*)dummy;
+	}
+
+	mutex_unlock(&device->dac_data.mutex);
+}
+
+// Ring capacity for the current configuration: the fixed legacy size, or the requested seconds of history
+// rounded up so that every frame layout still tiles the ring. 0 while the configuration is not known yet.
+static uint32_t zet017_ring_size(double seconds, uint32_t sample_rate, uint32_t frame_size, uint32_t granule, uint32_t legacy) {
+	if (seconds <= 0.)
+		return legacy;
+
+	if (sample_rate == 0 || frame_size == 0)
+		return 0;
+
+	double size = seconds * sample_rate * frame_size;
+	if (size >= ZET017_MAX_RING_SIZE)
+		return ZET017_MAX_RING_SIZE;
+
+	uint32_t ring_size = ((uint32_t)size + granule - 1) / granule * granule;
+	return ring_size != 0 ? ring_size : granule;
+}
+
+// Drops what the DAC ring holds; called with the DAC lock held. Nothing is cleared:
+// packets stamped with an older epoch read back as an underrun.
+static void zet017_dac_next_epoch(struct zet017_dac_data* dac_data) {
+	if (++dac_data->epoch == 0) {
+		if (dac_data->stamp != NULL)
+			memset(dac_data->stamp, 0x0, dac_data->size / ZET017_PACKET_SIZE * sizeof(uint32_t));
+		dac_data->epoch = 1;
+	}
+}
+
+static void zet017_device_reset_adc_dac(struct zet017_device* device) {
+	uint32_t sample_size = (uint32_t)(device->device_info.type_data_adc == 0 ? sizeof(int16_t) : sizeof(int32_t));
+	uint32_t size = zet017_ring_size(device->params.adc_seconds, device->adc_dac_data.sample_rate_adc,
+		device->device_info.work_channel_adc * sample_size, ZET017_ADC_GR_BUFFER_SIZE, ZET017_ADC_BUFFER_SIZE);
+
+	// Rings only grow. A replaced ADC ring is kept until the device is destroyed,
+	// so that views taken on it keep pointing at valid memory.
+	struct zet017_retired_buffer* retired = NULL;
+	uint8_t* buffer = NULL;
+	size_t mapped = 0;
+	if (size > device->adc_data.ring.size) {
+		retired = malloc(sizeof(struct zet017_retired_buffer));
+		if (retired != NULL) {
+			buffer = zet017_ring_alloc(size, device->params.flags, &mapped);
+			if (buffer == NULL) {
+				free(retired);
+				retired = NULL;
+			}
+		}
+	}
+
+	zet017_adc_ring_begin(&device->adc_data);
+
+	if (buffer != NULL) {
+		if (device->adc_data.ring.buffer != NULL) {
+			retired->buffer = device->adc_data.ring.buffer;
+			retired->mapped = device->adc_data.mapped;
+			retired->next = device->adc_data.retired;
+			device->adc_data.retired = retired;
+		}
+		else
+			free(retired);
+		device->adc_data.ring.buffer = buffer;
+		device->adc_data.ring.size = size;
+		device->adc_data.mapped = mapped;
+	}
+
+	if (device->adc_data.ring.size != 0) {
+		// The write sequence never goes back: a new stream starts at the next multiple of the ring size,
+		// so that the ring offset of every byte is still its sequence modulo the ring size.
+		uint64_t sequence = device->adc_data.sequence + device->adc_data.ring.size - 1;
+		sequence -= sequence % device->adc_data.ring.size;
+		atomic_store_u64(&device->adc_data.sequence_pending, sequence + device->adc_data.ring.size);
+		memory_fence();
+		device->adc_data.pointer = 0;
+		device->adc_data.ring.sequence_start = sequence;
+		atomic_store_u64(&device->adc_data.sequence, sequence);
+	}
+
+	zet017_adc_ring_end(&device->adc_data);
+
+	sample_size = (uint32_t)(device->device_info.type_data_dac == 0 ? sizeof(int16_t) : sizeof(int32_t));
+	size = zet017_ring_size(device->params.dac_seconds, device->adc_dac_data.sample_rate_dac,
+		device->device_info.work_channel_dac * sample_size, ZET017_DAC_GR_BUFFER_SIZE, ZET017_DAC_BUFFER_SIZE);
+
+	buffer = NULL;
+	uint32_t* stamp = NULL;
+	if (size > device->dac_data.size) {
+		stamp = calloc(size / ZET017_PACKET_SIZE, sizeof(uint32_t));
+		if (stamp != NULL) {
+			buffer = zet017_ring_alloc(size, device->params.flags, &mapped);
+			if (buffer == NULL) {
+				free(stamp);
+				stamp = NULL;
+			}
+		}
+	}
+
+	mutex_lock(&device->dac_data.mutex);
+	if (buffer != NULL) {
+		if (device->dac_data.buffer != NULL)
+			zet017_ring_free(device->dac_data.buffer, device->dac_data.mapped);
+		free(device->dac_data.stamp);
+		device->dac_data.buffer = buffer;
+		device->dac_data.size = size;
+		device->dac_data.mapped = mapped;
+		device->dac_data.stamp = stamp;
+	}
+	zet017_dac_next_epoch(&device->dac_data);
+	memset(device->dac_data.hold, 0x0, sizeof(device->dac_data.hold));
+	device->dac_data.pointer = 0;
+	mutex_unlock(&device->dac_data.mutex);
+
+	zet017_device_update_buffer_size(device);
+
+	device->adc_dac_data.adc_count = 0;
+	atomic_store_u64(&device->adc_dac_data.dac_count, 0);
+	atomic_store_u64(&device->adc_dac_data.dac_underrun, 0);
+	atomic_store_u64(&device->adc_dac_data.dac_late, 0);
+	device->adc_dac_data.dac_late_mark = 0;
+	device->adc_dac_data.dac_window_packets = 0;
+}
+
+static int zet017_device_get_info_cmd(struct zet017_device* device, union zet017_packet* packet) {
+	memset(packet, 0x0, sizeof(*packet));
+	packet->info.command = ZET017_CMD_GET_INFO;
+	if (zet017_device_process_command(device, packet) != 0)
+		return -1;
+
+	zet017_device_update_info(device, packet);
+
+	return 0;
+}
+
+static int zet017_device_put_info_cmd(struct zet017_device* device, union zet017_packet* packet) {
+	packet->info.command = ZET017_CMD_PUT_INFO;
+	if (0 != zet017_device_process_command(device, packet))
+		return -1;
+	
+	zet017_device_update_info(device, packet);
+
+	return 0;
+}
+
+// Split in two so that a group can send all its starts before it reads the first reply.
+static int zet017_device_start_send(struct zet017_device* device, union zet017_packet* packet) {
+	packet->info.command = ZET017_CMD_PUT_INFO;
+	if (0 != zet017_device_send_command(device, packet))
+		return -1;
+
+	return 0;
+}
+
+static int zet017_device_start_receive(struct zet017_device* device, union zet017_packet* packet) {
+	if (0 != zet017_device_receive_command(device, packet))
+		return -1;
+
+	zet017_device_update_info(device, packet);
+
+	zet017_device_reset_adc_dac(device);
+
+	return 0;
+}
+
+static int zet017_device_stop_cmd(struct zet017_device* device, union zet017_packet* packet) {
+	for (;;) {
+		if (device->device_info.start_adc == 0)
+			return 0;
+
+		memcpy(&packet->info, &device->device_info, sizeof(struct zet017_device_info));
+		packet->info.command = ZET017_CMD_PUT_INFO;
+		packet->info.start_adc = -1;
+		if (packet->info.start_dac != 0)
+			packet->info.start_dac = -1;
+		if (0 != zet017_device_process_command(device, packet))
+			break;
+
+		if (0 != zet017_device_wait_stop(device))
+			break;
+
+		memcpy(&packet->info, &device->device_info, sizeof(struct zet017_device_info));
+		packet->info.command = ZET017_CMD_PUT_INFO;
+		packet->info.start_adc = 0;
+		packet->info.start_dac = 0;
+		if (0 != zet017_device_process_command(device, packet))
+			break;
+
+		zet017_device_update_info(device, packet);
+
+		return 0;
+	}
+
+	return -1;
+}
+
+static void zet017_read_calibration_packet(union zet017_packet* packet, uint16_t command, uint32_t size) {
+	memset(&packet->cmd, 0x0, sizeof(struct zet017_command_info));
+	packet->cmd.command = command;
+	packet->cmd.error = 1;
+	packet->cmd.size = size;
+}
+
+// Correction and tenso blocks do not depend on each other, so both requests go out before either reply is read.
+static int zet017_device_read_calibration_cmd(struct zet017_device* device, union zet017_packet* packet) {
+	union zet017_packet tenso;
+	zet017_read_calibration_packet(packet, ZET017_CMD_READ_CORRECTION, sizeof(struct zet017_correction_info));
+	zet017_read_calibration_packet(&tenso, ZET017_CMD_READ_TENSO, sizeof(struct zet017_tenso_info));
+
+	for (;;) {
+		if (0 != zet017_device_send_command(device, packet))
+			break;
+
+		if (0 != zet017_device_send_command(device, &tenso))
+			break;
+
+		if (0 != zet017_device_receive_command(device, packet))
+			break;
+
+		if (packet->cmd.command == ZET017_CMD_READ_CORRECTION)
+			memcpy(&device->correction, packet->cmd.data.u8, sizeof(struct zet017_correction_info));
+		else
+			memset(&device->correction, 0x0, sizeof(struct zet017_correction_info));
+
+		if (0 != zet017_device_receive_command(device, &tenso))
+			break;
+
+		if (tenso.cmd.command == ZET017_CMD_READ_TENSO)
+			zet017_device_update_tenso_info(device, &tenso);
+		else
+			memset(&device->tenso_info, 0x0, sizeof(struct zet017_tenso_info));
+
+		device->calibration.valid = 1;
+		device->calibration.serial = device->device_info.serial;
+		memcpy(device->calibration.version, device->device_info.version_dsp, sizeof(device->calibration.version));
+
+		return 0;
+	}
+
+	device->calibration.valid = 0;
+
+	return -1;
+}
+
+static int zet017_device_calibration_cached(struct zet017_device* device) {
+	return device->calibration.valid && device->calibration.serial == device->device_info.serial &&
+		memcmp(device->calibration.version, device->device_info.version_dsp, sizeof(device->calibration.version)) == 0;
+}
+
+static uint32_t zet017_calibration_checksum(const struct zet017_calibration_file* file) {
+	const uint8_t* data = (const uint8_t*)file;
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < offsetof(struct zet017_calibration_file, checksum); ++i)
+		hash = (hash ^ data[i]) * 16777619u;
+	return hash;
+}
+
+// Cache file name for a serial, NULL when no cache directory is set. The caller frees the result.
+static char* zet017_calibration_path(struct zet017_device* device, uint32_t serial, const char* suffix) {
+	const char* dir = device->server != NULL ? device->server->cache_dir : NULL;
+	if (dir == NULL)
+		return NULL;
+
+	size_t size = strlen(dir) + 32;
+	char* path = malloc(size);
+	if (path != NULL)
+		snprintf(path, size, "%s/zet017_%u.cal%s", dir, serial, suffix);
+	return path;
+}
+
+// Fills the correction and tenso blocks from the cache directory when the file matches the connected device.
+static int zet017_calibration_load(struct zet017_device* device) {
+	char* path = zet017_calibration_path(device, device->device_info.serial, "");
+	if (path == NULL)
+		return -1;
+
+	struct zet017_calibration_file* file = malloc(sizeof(struct zet017_calibration_file));
+	int r = -1;
+	FILE* stream = file != NULL ? fopen(path, "rb") : NULL;
+	if (stream != NULL) {
+		if (fread(file, sizeof(*file), 1, stream) == 1 &&
+			file->magic == ZET017_CALIBRATION_MAGIC &&
+			file->format == ZET017_CALIBRATION_FORMAT &&
+			file->size == sizeof(*file) &&
+			file->serial == device->device_info.serial &&
+			memcmp(file->version, device->device_info.version_dsp, sizeof(file->version)) == 0 &&
+			file->checksum == zet017_calibration_checksum(file)) {
+			memcpy(&device->correction, &file->correction, sizeof(device->correction));
+			zet017_device_set_tenso_info(device, &file->tenso);
+
+			device->calibration.valid = 1;
+			device->calibration.serial = file->serial;
+			memcpy(device->calibration.version, file->version, sizeof(device->calibration.version));
+			r = 0;
+		}
+		fclose(stream);
+	}
+
+	free(file);
+	free(path);
+
+	return r;
+}
+
+// Written to a temporary file and renamed, so a reader never sees a half-written cache.
+static void zet017_calibration_store(struct zet017_device* device) {
+	if (!device->calibration.valid)
+		return;
+
+	char* path = zet017_calibration_path(device, device->calibration.serial, "");
+	char* temp = zet017_calibration_path(device, device->calibration.serial, ".tmp");
+	struct zet017_calibration_file* file = malloc(sizeof(struct zet017_calibration_file));
+	for (;;) {
+		if (path == NULL || temp == NULL || file == NULL)
+			break;
+
+		memset(file, 0x0, sizeof(*file));
+		file->magic = ZET017_CALIBRATION_MAGIC;
+		file->format = ZET017_CALIBRATION_FORMAT;
+		file->size = sizeof(*file);
+		file->serial = device->calibration.serial;
+		memcpy(file->version, device->calibration.version, sizeof(file->version));
+		memcpy(&file->correction, &device->correction, sizeof(file->correction));
+		memcpy(&file->tenso, &device->tenso_info, sizeof(file->tenso));
+		file->checksum = zet017_calibration_checksum(file);
+
+		FILE* stream = fopen(temp, "wb");
+		if (stream == NULL)
+			break;
+
+		int r = fwrite(file, sizeof(*file), 1, stream) == 1;
+		if (fclose(stream) != 0 || !r) {
+			remove(temp);
+			break;
+		}
+
+#if defined(ZET017_TCP_WINDOWS)
+		if (!MoveFileExA(temp, path, MOVEFILE_REPLACE_EXISTING))
+#else
+		if (rename(temp, path) != 0)
+#endif
+			remove(temp);
+		break;
+	}
+
+	free(file);
+	free(temp);
+	free(path);
+}
+
+static void zet017_calibration_drop(struct zet017_device* device) {
+	device->calibration.valid = 0;
+
+	char* path = zet017_calibration_path(device, device->device_info.serial, "");
+	if (path != NULL) {
+		remove(path);
+		free(path);
+	}
+}
+
+static int zet017_device_write_tenso_cmd(struct zet017_device* device, union zet017_packet* packet) {
+	packet->cmd.command = ZET017_CMD_WRITE_TENSO;
+	packet->cmd.error = 1;
+	packet->cmd.size = sizeof(struct zet017_tenso_info);
+	if (0 != zet017_device_process_command(device, packet)) {
+		// The device may or may not have taken the new blocks, the next connection reads them back.
+		zet017_calibration_drop(device);
+		return -1;
+	}
+
+	zet017_device_update_tenso_info(device, packet);
+	zet017_calibration_store(device);
+
+	return 0;
+}
+
+static int zet017_device_connect(struct zet017_device* device) {
+	if (zet017_device_connect_sockets(device) != 0) {
+		zet017_device_close(device);
+		return -1;
+	}
+
+	zet017_device_reset_adc_dac(device);
+
+	return 0;
+}
+
+static int zet017_device_init(struct zet017_device* device, union zet017_packet* packet) {
+	for (;;) {
+		if (zet017_device_get_info_cmd(device, packet) != 0)
+			break;
+
+		packet->info.start_adc = packet->info.start_dac = 0;
+		zet017_set_size_packet_adc(&packet->info);
+
+		// An idle device that already has the packet size set needs no PUT_INFO.
+		if (memcmp(&packet->info, &device->device_info, sizeof(struct zet017_device_info)) != 0 &&
+			zet017_device_put_info_cmd(device, packet) != 0)
+			break;
+
+		if (!zet017_device_calibration_cached(device) && zet017_calibration_load(device) != 0) {
+			if (zet017_device_read_calibration_cmd(device, packet) != 0)
+				break;
+
+			zet017_calibration_store(device);
+		}
+
+		zet017_device_update_adc_dac_info(device);
+
+		device->timestamp = zet017_get_timestamp();
+
+		return 0;
+	}
+
+	zet017_device_close(device);
+
+	return -1;
+}
+
+// The first write to a packet since it was sent or since the start clears its stale contents.
+static void zet017_dac_touch(struct zet017_dac_data* dac_data, uint32_t packet) {
+	if (dac_data->stamp[packet] != dac_data->epoch) {
+		memset(dac_data->buffer + packet * ZET017_PACKET_SIZE, 0, ZET017_PACKET_SIZE);
+		dac_data->stamp[packet] = dac_data->epoch;
+	}
+}
+
+// Completes a packet from byte offset `filled` according to the underrun policy,
+// returns the number of frames that had to be made up.
+static uint32_t zet017_dac_fill_underrun(
+	struct zet017_dac_data* dac_data, union zet017_packet* packet, uint32_t filled, uint32_t step) {
+	if (dac_data->underrun == zet017_dac_underrun_hold && step != 0) {
+		for (uint32_t i = filled; i + step <= ZET017_PACKET_SIZE; i += step)
+			memcpy(packet->raw + i, dac_data->hold, step);
+	}
+	else
+		memset(packet->raw + filled, 0, ZET017_PACKET_SIZE - filled);
+
+	return step != 0 ? (ZET017_PACKET_SIZE - filled) / step : 0;
+}
+
+// The DAC ring is a whole number of packets and is sent packet by packet from offset 0,
+// so every outgoing packet is exactly one stamped chunk of the ring.
+static void zet017_dac_fill_packet(struct zet017_device* device, union zet017_packet* packet) {
+	struct zet017_dac_data* dac_data = &device->dac_data;
+
+	// A registered callback writes straight into the packet, whatever it leaves unwritten is an underrun.
+	// It runs on the network thread under callback_mutex but without the DAC lock: non-blocking calls are
+	// fine, while blocking commands, removing the device or swapping the callback would wait for this thread.
+	int called = 0;
+	uint32_t filled = 0;
+	mutex_lock(&dac_data->callback_mutex);
+	if (dac_data->callback != NULL) {
+		struct zet017_dac_block block;
+		mutex_lock(&dac_data->mutex);
+		block.data = packet->raw;
+		block.sample_size = dac_data->sample_size;
+		block.work_channel = dac_data->channel_quantity;
+		block.channel_mask = dac_data->channel_mask;
+		for (uint32_t i = 0; i < ZET017_MAX_CHANNELS_DAC; ++i)
+			block.resolution[i] = dac_data->resolution[i];
+		mutex_unlock(&dac_data->mutex);
+
+		uint32_t step = block.sample_size * block.work_channel;
+		if (step != 0) {
+			block.frames = ZET017_PACKET_SIZE / step;
+			block.frame = device->adc_dac_data.dac_count;
+			uint32_t frames = dac_data->callback(dac_data->context, &block);
+			filled = (frames < block.frames ? frames : block.frames) * step;
+			called = 1;
+		}
+	}
+	mutex_unlock(&dac_data->callback_mutex);
+
+	mutex_lock(&dac_data->mutex);
+
+	uint32_t step = dac_data->sample_size * dac_data->channel_quantity;
+	if (step > sizeof(dac_data->hold))
+		step = 0;
+
+	uint32_t underrun = 0;
+	if (called) {
+		// The ring is bypassed but still walked, so that pointer_dac keeps following the output.
+		if (step != 0 && filled >= step)
+			memcpy(dac_data->hold, packet->raw + filled - step, step);
+		underrun = zet017_dac_fill_underrun(dac_data, packet, filled, step);
+	}
+	else if (dac_data->size != 0 && dac_data->stamp[dac_data->pointer / ZET017_PACKET_SIZE] == dac_data->epoch) {
+		memcpy(packet->raw, dac_data->buffer + dac_data->pointer, ZET017_PACKET_SIZE);
+		dac_data->stamp[dac_data->pointer / ZET017_PACKET_SIZE] = 0;
+		if (step != 0)
+			memcpy(dac_data->hold, packet->raw + ZET017_PACKET_SIZE - step, step);
+	}
+	else
+		underrun = zet017_dac_fill_underrun(dac_data, packet, 0, step);
+
+	if (dac_data->size != 0) {
+		dac_data->pointer += ZET017_PACKET_SIZE;
+		if (dac_data->pointer >= dac_data->size)
+			dac_data->pointer = 0;
+	}
+
+	mutex_unlock(&dac_data->mutex);
+
+	if (underrun != 0)
+		atomic_store_u64(&device->adc_dac_data.dac_underrun, device->adc_dac_data.dac_underrun + underrun);
+}
+
+static uint32_t zet017_dac_packet_frames(struct zet017_adc_dac_data* data) {
+	uint32_t step = (uint32_t)data->work_channel_dac * data->sample_size_dac;
+	return step != 0 ? ZET017_PACKET_SIZE / step : 1;
+}
+
+// How far ahead of the device the DAC stream is sent, in frames. A fixed window comes from
+// milliseconds; the low latency window starts at two packets and widens by a packet every time
+// the device is found to have run dry, up to the default window.
+static uint32_t zet017_dac_window(struct zet017_adc_dac_data* data) {
+	uint32_t ms = atomic_load_u32(&data->dac_window_ms);
+	uint32_t packet = zet017_dac_packet_frames(data);
+	uint64_t window;
+	if (ms == ZET017_DAC_WINDOW_LOW_LATENCY)
+		window = (uint64_t)(2 + data->dac_window_packets) * packet;
+	else
+		window = (uint64_t)data->sample_rate_dac * ms / 1000;
+	if (window < packet)
+		window = packet;
+	if (window > 0xffffffff)
+		window = 0xffffffff;
+
+	if (data->dac_window != (uint32_t)window)
+		atomic_store_u32(&data->dac_window, (uint32_t)window);
+
+	return (uint32_t)window;
+}
+
+// ADC frames received are a lower bound of the device clock. Whatever part of it the DAC stream
+// has not covered yet was played out before it arrived; each device frame is counted once.
+static void zet017_dac_check_late(struct zet017_adc_dac_data* data) {
+	if (data->sample_rate_adc == 0)
+		return;
+
+	uint64_t played = data->adc_count * data->sample_rate_dac / data->sample_rate_adc;
+	uint64_t from = data->dac_count > data->dac_late_mark ? data->dac_count : data->dac_late_mark;
+	if (played <= from)
+		return;
+
+	data->dac_late_mark = played;
+	atomic_store_u64(&data->dac_late, data->dac_late + (played - from));
+
+	if (atomic_load_u32(&data->dac_window_ms) == ZET017_DAC_WINDOW_LOW_LATENCY &&
+		(uint64_t)(3 + data->dac_window_packets) * zet017_dac_packet_frames(data) <= data->sample_rate_dac * ZET017_DAC_WINDOW_DEFAULT_MS / 1000)
+		++data->dac_window_packets;
+}
+
+static int zet017_adc_dac_interest(struct zet017_device* device, uint32_t* interest) {
+	interest[zet017_event_wakeup] = ZET017_EVENT_READ;
+	interest[zet017_event_cmd] = 0;
+	interest[zet017_event_adc] = ZET017_EVENT_READ;
+	interest[zet017_event_dac] = ZET017_EVENT_READ;
+
+	int dac = 0;
+	if (device->device_info.start_dac) {
+		uint64_t dac_count =
+			device->adc_dac_data.adc_count * device->adc_dac_data.sample_rate_dac / device->adc_dac_data.sample_rate_adc;
+		if (device->adc_dac_data.dac_count < dac_count + zet017_dac_window(&device->adc_dac_data))
+			dac = 1;
+	}
+	if (dac != 0)
+		interest[zet017_event_dac] |= ZET017_EVENT_WRITE;
+
+	return dac;
+}
+
+// Hands the packets a receive call committed, from `sequence` and frame `frame` on, to the registered callback.
+// The ring and its layout are only written by this thread, so they stay put while the callback runs.
+static void zet017_adc_call(struct zet017_device* device, uint64_t sequence, uint64_t frame) {
+	struct zet017_adc_data* adc_data = &device->adc_data;
+	if (atomic_load_ptr((void* volatile*)&adc_data->callback) == NULL)
+		return;
+
+	mutex_lock(&adc_data->callback_mutex);
+	if (adc_data->callback != NULL) {
+		struct zet017_adc_block block;
+		memset(&block, 0x0, sizeof(block));
+		const struct zet017_adc_ring* ring = &adc_data->ring;
+		block.sample_size = ring->sample_size;
+		block.work_channel = ring->work_channel;
+		block.channel_mask = ring->channel_mask;
+		uint32_t offset = (uint32_t)(sequence % ring->size);
+		uint32_t size = (uint32_t)(adc_data->sequence - sequence);
+		block.span[0].data = ring->buffer + offset;
+		block.span[0].size = size;
+		if (size > ring->size - offset) {
+			block.span[0].size = ring->size - offset;
+			block.span[1].data = ring->buffer;
+			block.span[1].size = size - block.span[0].size;
+		}
+
+		block.sequence = sequence;
+		block.frame = frame;
+		block.frames = (uint32_t)(device->adc_dac_data.adc_count - frame);
+		adc_data->callback(adc_data->context, &block);
+	}
+	mutex_unlock(&adc_data->callback_mutex);
+}
+
+static void zet017_process_adc_dac(struct zet017_device* device, union zet017_packet* packet, int timeout_ms) {
+	uint32_t interest[zet017_event_count];
+	int dac = zet017_adc_dac_interest(device, interest);
+
+	int r = zet017_events_wait(&device->events, interest, timeout_ms);
+	if (r == -1) {
+		zet017_device_close(device);
+		return;
+	}
+
+	if (r > 0) {
+		if (device->events.ready[zet017_event_adc] & ZET017_EVENT_READ) {
+			// Drain the socket: keep receiving while the batch comes back full.
+			for (;;) {
+				int full = 0;
+				uint64_t sequence = device->adc_data.sequence;
+				uint64_t frame = device->adc_dac_data.adc_count;
+				r = zet017_receive_adc_direct(device, &full);
+				if (r < 0) {
+					zet017_device_close(device);
+					return;
+				}
+
+				if (device->adc_data.sequence != sequence)
+					zet017_adc_call(device, sequence, frame);
+
+				if (!full)
+					break;
+			}
+		}
+
+		if (device->events.ready[zet017_event_dac] & ZET017_EVENT_READ) {
+			r = recv(device->dac_socket, packet->raw, sizeof(*packet), 0);
+			if (r <= 0) {
+				zet017_device_close(device);
+				return;
+			}
+		}
+
+		if (dac != 0) {
+			if (device->events.ready[zet017_event_dac] & ZET017_EVENT_WRITE) {
+				zet017_dac_check_late(&device->adc_dac_data);
+				zet017_dac_fill_packet(device, packet);
+
+				r = send(device->dac_socket, packet->raw, sizeof(*packet), 0);
+				if (r != sizeof(*packet)) {
+					zet017_device_close(device);
+					return;
+				}
+				atomic_store_u64(&device->adc_dac_data.dac_count, device->adc_dac_data.dac_count +
+					sizeof(*packet) / device->adc_dac_data.work_channel_dac / device->adc_dac_data.sample_size_dac);
+			}
+		}
+
+		if ((device->events.ready[zet017_event_wakeup] & ZET017_EVENT_READ) && zet017_wakeup_drain(device) != 0) {
+			zet017_device_close(device);
+			return;
+		}
+	}
+}
+
+// Called by the worker after the state is published: wakes the waiters and raises the descriptor
+// once the watermark of frames has arrived since it was last raised.
+static void zet017_notify_update(struct zet017_device* device) {
+	struct zet017_notify_data* notify = &device->notify;
+
+	uint32_t watermark = atomic_load_u32(&notify->watermark);
+	if (watermark != 0) {
+		uint64_t frames = device->adc_dac_data.adc_count;
+		if (frames < notify->mark)
+			notify->mark = 0;
+		if (frames - notify->mark >= watermark) {
+			notify->mark = frames;
+			zet017_signal_raise(notify->signal);
+		}
+	}
+
+	if (atomic_load_u32(&notify->waiters) != 0) {
+		mutex_lock(&notify->mutex);
+		cond_broadcast(&notify->cond);
+		mutex_unlock(&notify->mutex);
+	}
+}
+
+static int zet017_info_due(struct zet017_device* device) {
+	return zet017_get_timestamp() - device->timestamp > 60000;
+}
+
+static void zet017_publish_state(struct zet017_device* device) {
+	mutex_lock(&device->state_mutex);
+
+	device->state.is_connected = device->is_connected;
+	device->state.reconnect = device->reconnect;
+	device->state.pointer_adc = device->adc_data.pointer / device->device_info.work_channel_adc;
+	if (device->device_info.type_data_adc == 0)
+		device->state.pointer_adc /= sizeof(int16_t);
+	if (device->device_info.type_data_adc == 1)
+		device->state.pointer_adc /= sizeof(int32_t);
+	if (device->device_info.work_channel_dac != 0)
+		device->state.pointer_dac = device->dac_data.pointer / device->device_info.work_channel_dac;
+	else
+		device->state.pointer_dac = 0;
+	if (device->device_info.type_data_dac == 0)
+		device->state.pointer_dac /= sizeof(int16_t);
+	if (device->device_info.type_data_dac == 1)
+		device->state.pointer_dac /= sizeof(int32_t);
+
+	mutex_unlock(&device->state_mutex);
+
+	zet017_notify_update(device);
+}
+
+static void zet017_update_state(struct zet017_device* device, union zet017_packet* packet) {
+	if (zet017_info_due(device)) {
+		device->timestamp = zet017_get_timestamp();
+		if (zet017_device_get_info_cmd(device, packet) != 0)
+		{
+			zet017_device_close(device);
+			return;
+		}
+	}
+
+	zet017_publish_state(device);
+}
+
+static int zet017_command_set_config(
+	struct zet017_device* device, const struct zet017_config* config, union zet017_packet* packet) {
+	memcpy(&packet->info, &device->device_info, sizeof(struct zet017_device_info));
+	if (config->sample_rate_adc)
+		packet->info.mode_adc = zet017_get_mode_adc(config->sample_rate_adc);
+	else
+		packet->info.mode_adc = config->moda_adc;
+	if (config->sample_rate_dac)
+		packet->info.rate_dac = zet017_get_rate_dac(config->sample_rate_dac);
+	else
+		packet->info.rate_dac = config->rate_dac;
+	packet->info.mask_channel_adc = config->mask_channel_adc;
+	packet->info.mask_icp = config->mask_icp;
+	for (uint32_t i = 0; i < 8; ++i) {
+		if (config->gain[i])
+			packet->info.amplify_code[i] = zet017_get_amplify_code(config->gain[i]);
+		else
+			packet->info.amplify_code[i] = config->gain_code[i];
+	}
+	if (packet->info.quantity_channel_adc == 4) {
+		packet->info.mask_channel_adc = 
+			((config->mask_channel_adc & 0x1) << 1) +
+			((config->mask_channel_adc & 0x2) << 2) +
+			((config->mask_channel_adc & 0x4) << 3) +
+			((config->mask_channel_adc & 0x8) << 4);
+		packet->info.mask_icp =
+			((config->mask_icp & 0x1) << 1) +
+			((config->mask_icp & 0x2) << 2) +
+			((config->mask_icp & 0x4) << 3) +
+			((config->mask_icp & 0x8) << 4);
+		for (uint32_t i = 0; i < 8; ++i) {
+			if (config->gain[i / 2])
+				packet->info.amplify_code[i] = zet017_get_amplify_code(config->gain[i / 2]);
+			else
+				packet->info.amplify_code[i] = config->gain_code[i / 2];
+		}
+	}
+	packet->info.builtin_dac_state = config->builtin_dac_state;
+	packet->info.builtin_dac_sine_freq = (int32_t)config->builtin_dac_sine_freq;
+	double resolution_dac = packet->info.resolution_dac[0];
+	if (!resolution_dac)
+		resolution_dac = packet->info.resolution_dac_def;
+	packet->info.builtin_dac_sine_ampl = (int32_t)(config->builtin_dac_sine_ampl / resolution_dac);
+	packet->info.builtin_dac_sine_offset = (int32_t)(config->builtin_dac_sine_offset / resolution_dac);
+	zet017_set_size_packet_adc(&packet->info);
+
+	int r = zet017_device_put_info_cmd(device, packet);
+	zet017_device_update_adc_dac_info(device);
+
+	return r;
+}
+
+static int zet017_command_write_tenso_config(
+	struct zet017_device* device, const struct zet017_tenso_config* config, union zet017_packet* packet) {
+	memcpy(packet->cmd.data.u8, &device->tenso_info, sizeof(struct zet017_tenso_info));
+	struct zet017_tenso_info* tenso_info = (struct zet017_tenso_info*)(&packet->cmd.data);
+	for (uint32_t i = 0; i < 8; ++i) {
+		tenso_info->scheme[i] = (uint16_t)config->scheme[i];
+		tenso_info->correction[i][0] = config->correction_1[i];
+		tenso_info->correction[i][1] = config->correction_2[i];
+	}
+
+	return zet017_device_write_tenso_cmd(device, packet);
+}
+
+// Returns 0 once the start is sent, 1 if the device runs already and -1 on error.
+static int zet017_command_start_send(struct zet017_device* device, uint32_t dac, union zet017_packet* packet) {
+	if (device->device_info.start_adc)
+		return 1;
+
+	memcpy(&packet->info, &device->device_info, sizeof(struct zet017_device_info));
+	packet->info.start_adc = 1;
+	packet->info.start_dac = (int16_t)dac;
+	memset(&packet->info.atten, 0xff, sizeof(packet->info.atten));
+	packet->info.atten_speed = 0;
+
+	atomic_store_u64(&device->adc_dac_data.first_packet_time, 0);
+	atomic_store_u64(&device->adc_dac_data.start_time, zet017_get_time_us());
+	return zet017_device_start_send(device, packet);
+}
+
+// Completes a start with the outcome of zet017_command_start_send().
+static int zet017_command_start(struct zet017_device* device, int sent, union zet017_packet* packet) {
+	if (sent != 0)
+		return sent > 0 ? 0 : sent;
+
+	int r = zet017_device_start_receive(device, packet);
+	zet017_device_update_adc_dac_info(device);
+
+	return r;
+}
+
+// Runs the queued requests in order. Once the connection is gone the rest fail at once
+// instead of waiting for a reconnect.
+static void zet017_process_command(struct zet017_device* device) {
+	for (;;) {
+		mutex_lock(&device->command.mutex);
+		struct zet017_request* request = device->command.head;
+		mutex_unlock(&device->command.mutex);
+
+		if (request == NULL)
+			return;
+
+		// Only this thread removes requests, so the head stays put until it is taken below.
+		if (request->group != NULL && device->is_connected && !zet017_group_arrive(request))
+			return;
+
+		mutex_lock(&device->command.mutex);
+		device->command.head = request->next;
+		if (device->command.head == NULL)
+			device->command.tail = NULL;
+		mutex_unlock(&device->command.mutex);
+
+		int result = -1;
+		if (device->is_connected && zet017_wakeup_drain(device) == 0) {
+			switch (request->command) {
+			case zet017_set_config:
+				result = zet017_command_set_config(device, &request->args.config, &device->command.data);
+				break;
+			case zet017_write_tenso_config:
+				result = zet017_command_write_tenso_config(device, &request->args.tenso_config, &device->command.data);
+				break;
+			case zet017_start:
+				// A group start may have been sent already, see zet017_worker_send_start().
+				if (!request->sent)
+					request->result = zet017_command_start_send(device, request->args.dac, &device->command.data);
+				result = zet017_command_start(device, request->result, &device->command.data);
+				break;
+			case zet017_stop:
+				result = zet017_device_stop_cmd(device, &device->command.data);
+				break;
+			default:
+				break;
+			}
+			if (result != 0)
+				zet017_device_close(device);
+		}
+
+		zet017_request_complete(request, result);
+	}
+}
+
+// Whether a reconnect attempt is due: the first one, after the backoff has run out, or on request.
+static int zet017_connect_ready(struct zet017_connect_data* connect) {
+	return !connect->scheduled || connect->nudge || (int32_t)(zet017_get_timestamp() - connect->next) >= 0;
+}
+
+static int zet017_connect_pending(struct zet017_device* device) {
+	mutex_lock(&device->connect.mutex);
+	int due = zet017_connect_ready(&device->connect);
+	mutex_unlock(&device->connect.mutex);
+
+	return due;
+}
+
+static int zet017_connect_due(struct zet017_device* device) {
+	struct zet017_connect_data* connect = &device->connect;
+
+	mutex_lock(&connect->mutex);
+	int due = zet017_connect_ready(connect);
+	if (due) {
+		connect->nudge = 0;
+		++connect->attempts;
+	}
+	mutex_unlock(&connect->mutex);
+
+	return due;
+}
+
+// Failures back off exponentially between the policy bounds with equal jitter: the wait is half the
+// interval plus a random share of the other half, so a rack that went down together spreads out.
+static void zet017_connect_done(struct zet017_device* device, uint32_t elapsed) {
+	struct zet017_connect_data* connect = &device->connect;
+
+	mutex_lock(&connect->mutex);
+	if (device->is_connected) {
+		uint32_t bucket = 0;
+		while (bucket + 1 < ZET017_CONNECT_HISTOGRAM && (elapsed >> bucket) != 0)
+			++bucket;
+		++connect->histogram[bucket];
+		connect->last_time = elapsed;
+		connect->backoff = 0;
+		connect->scheduled = 0;
+	}
+	else {
+		++connect->failures;
+		if (connect->backoff == 0)
+			connect->backoff = connect->min_interval;
+		else if (connect->backoff < connect->max_interval / 2)
+			connect->backoff *= 2;
+		else
+			connect->backoff = connect->max_interval;
+
+		connect->seed ^= connect->seed << 13;
+		connect->seed ^= connect->seed >> 17;
+		connect->seed ^= connect->seed << 5;
+		uint32_t half = connect->backoff / 2;
+		connect->next = zet017_get_timestamp() + half + connect->seed % (connect->backoff - half + 1);
+		connect->scheduled = 1;
+	}
+	mutex_unlock(&connect->mutex);
+}
+
+// Sleeps a dedicated device thread until the next reconnect attempt, a nudge or the stop.
+static void zet017_connect_sleep(struct zet017_device* device) {
+	struct zet017_connect_data* connect = &device->connect;
+
+	mutex_lock(&connect->mutex);
+	while (device->running && !connect->nudge) {
+		int32_t remaining = connect->scheduled ? (int32_t)(connect->next - zet017_get_timestamp()) : 0;
+		if (remaining <= 0)
+			break;
+		cond_timedwait(&connect->cond, &connect->mutex, (uint32_t)remaining);
+	}
+	mutex_unlock(&connect->mutex);
+}
+
+static int zet017_device_step(struct zet017_device* device, union zet017_packet* packet, int timeout_ms) {
+	if (device->is_connected)
+		zet017_process_adc_dac(device, packet, timeout_ms);
+	else {
+		if (zet017_connect_due(device)) {
+			uint32_t start = zet017_get_timestamp();
+			zet017_connect_fail(device, zet017_connect_error_none, 0);
+			if (zet017_device_connect(device) == 0) {
+				if (zet017_device_init(device, packet) == 0) {
+					device->is_connected = 1;
+					++device->reconnect;
+				}
+				else if (device->connect.error == zet017_connect_error_none)
+					zet017_connect_fail(device, zet017_connect_error_init, 0);
+			}
+			zet017_connect_done(device, zet017_get_timestamp() - start);
+		}
+
+		if (!device->is_connected) {
+			(void)zet017_wakeup_drain(device);
+			zet017_process_command(device);
+			return -1;
+		}
+	}
+
+	zet017_process_command(device);
+
+	zet017_update_state(device, packet);
+
+	return 0;
+}
+
+static THREAD_RETURN zet017_device_thread_func(void* arg) {
+	struct zet017_device* device = (struct zet017_device*)arg;
+	union zet017_packet packet;
+
+	while (device->running) {
+		if (zet017_device_step(device, &packet, 10000) != 0)
+			zet017_connect_sleep(device);
+	}
+
+#if defined(ZET017_TCP_WINDOWS)
+	return 0;
+#else
+	return NULL;
+#endif
+}
+
+// Next device for a control thread: commands first, connects only while they hold less than half of the pool.
+static struct zet017_device* zet017_control_take(struct zet017_control_pool* pool) {
+	uint32_t queue = 0;
+	if (pool->head[0] == NULL) {
+		if (pool->head[1] == NULL || pool->connecting >= (pool->count + 1) / 2)
+			return NULL;
+		queue = 1;
+	}
+
+	struct zet017_device* device = pool->head[queue];
+	pool->head[queue] = device->control_next;
+	if (pool->head[queue] == NULL)
+		pool->tail[queue] = NULL;
+	device->control_next = NULL;
+
+	return device;
+}
+
+// Wait, commands and the info request of a pooled device, run once on the control pool like one round
+// of a dedicated thread. The device is handed back to its worker when it is done.
+static THREAD_RETURN zet017_control_thread_func(void* arg) {
+	struct zet017_control_pool* pool = (struct zet017_control_pool*)arg;
+	union zet017_packet packet;
+
+	mutex_lock(&pool->mutex);
+	while (pool->running) {
+		struct zet017_device* device = zet017_control_take(pool);
+		if (device == NULL) {
+			cond_wait(&pool->cond, &pool->mutex);
+			continue;
+		}
+
+		uint16_t connect = device->control_connect;
+		if (connect)
+			++pool->connecting;
+		mutex_unlock(&pool->mutex);
+
+		(void)zet017_device_step(device, &packet, 0);
+
+		mutex_lock(&pool->mutex);
+		if (connect) {
+			--pool->connecting;
+			cond_signal(&pool->cond);
+		}
+		// Under the mutex, so that zet017_control_cancel() cannot free the device in between.
+		atomic_store_u32(&device->control, zet017_control_done);
+		zet017_signal_raise(device->worker->signal);
+		cond_broadcast(&pool->done);
+	}
+	mutex_unlock(&pool->mutex);
+
+#if defined(ZET017_TCP_WINDOWS)
+	return 0;
+#else
+	return NULL;
+#endif
+}
+
+static void zet017_control_stop(struct zet017_control_pool* pool) {
+	mutex_lock(&pool->mutex);
+	pool->running = 0;
+	cond_broadcast(&pool->cond);
+	mutex_unlock(&pool->mutex);
+
+	for (uint32_t i = 0; i < pool->count; ++i) {
+#if defined(ZET017_TCP_WINDOWS)
+		WaitForSingleObject(pool->threads[i], INFINITE);
+		CloseHandle(pool->threads[i]);
+#else
+		pthread_join(pool->threads[i], NULL);
+#endif
+	}
+	free(pool->threads);
+	pool->threads = NULL;
+	pool->count = 0;
+
+	cond_destroy(&pool->done);
+	cond_destroy(&pool->cond);
+	mutex_destroy(&pool->mutex);
+}
+
+static int zet017_control_start_pool(struct zet017_control_pool* pool, uint32_t count) {
+	memset(pool, 0x0, sizeof(struct zet017_control_pool));
+	pool->threads = malloc(count * sizeof(thread_t));
+	if (pool->threads == NULL)
+		return -1;
+	if (0 != mutex_init(&pool->mutex)) {
+		free(pool->threads);
+		return -1;
+	}
+	if (0 != cond_init(&pool->cond)) {
+		mutex_destroy(&pool->mutex);
+		free(pool->threads);
+		return -1;
+	}
+	if (0 != cond_init(&pool->done)) {
+		cond_destroy(&pool->cond);
+		mutex_destroy(&pool->mutex);
+		free(pool->threads);
+		return -1;
+	}
+
+	pool->running = 1;
+	for (; pool->count < count; ++pool->count) {
+#if defined(ZET017_TCP_WINDOWS)
+		pool->threads[pool->count] = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE)zet017_control_thread_func, pool, 0, NULL);
+		if (pool->threads[pool->count] == NULL)
+#else
+		if (0 != pthread_create(&pool->threads[pool->count], NULL, zet017_control_thread_func, pool))
+#endif
+			break;
+	}
+	if (pool->count != count) {
+		zet017_control_stop(pool);
+		return -1;
+	}
+
+	return 0;
+}
+
+// While a control thread has the device, its descriptors stay out of the worker's wait.
+static void zet017_worker_watch(struct zet017_worker* worker, struct zet017_device* device, int watch) {
+#if defined(ZET017_TCP_EPOLL)
+	struct epoll_event event;
+	memset(&event, 0x0, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.ptr = device;
+	(void)epoll_ctl(worker->events_fd, watch ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, device->events.fd, &event);
+#else
+	(void)worker;
+	(void)device;
+	(void)watch;
+#endif
+}
+
+static void zet017_control_start(struct zet017_worker* worker, struct zet017_device* device, int connect) {
+	struct zet017_control_pool* pool = &device->server->control;
+	zet017_worker_watch(worker, device, 0);
+	atomic_store_u32(&device->control, zet017_control_running);
+
+	mutex_lock(&pool->mutex);
+	uint32_t queue = connect ? 1 : 0;
+	device->control_connect = (uint16_t)connect;
+	device->control_next = NULL;
+	if (pool->tail[queue] != NULL)
+		pool->tail[queue]->control_next = device;
+	else
+		pool->head[queue] = device;
+	pool->tail[queue] = device;
+	cond_signal(&pool->cond);
+	mutex_unlock(&pool->mutex);
+}
+
+// Takes back a device the control pool is done with.
+static void zet017_control_finish(struct zet017_worker* worker, struct zet017_device* device) {
+	atomic_store_u32(&device->control, zet017_control_idle);
+	zet017_worker_watch(worker, device, 1);
+}
+
+// A queued request is taken on as soon as it can run; a group member waits, streaming, for its release.
+static int zet017_command_ready(struct zet017_device* device) {
+	mutex_lock(&device->command.mutex);
+	struct zet017_request* request = device->command.head;
+	mutex_unlock(&device->command.mutex);
+
+	return request != NULL && (request->group == NULL || zet017_group_arrive(request));
+}
+
+// Sends a released group start right away, its reply is left to the control pool. The worker sends
+// every start it holds before it queues anything on the pool, see zet017_worker_thread_func(), so the
+// devices on one worker start a send apart rather than a round trip apart.
+static int zet017_worker_send_start(struct zet017_worker* worker, struct zet017_device* device) {
+	mutex_lock(&device->command.mutex);
+	struct zet017_request* request = device->command.head;
+	mutex_unlock(&device->command.mutex);
+
+	if (request == NULL || request->group == NULL || request->command != zet017_start || request->sent)
+		return 0;
+	uint32_t control = atomic_load_u32(&device->control);
+	if (control == zet017_control_running)
+		return 0;
+	if (control == zet017_control_done)
+		zet017_control_finish(worker, device);
+	if (!device->is_connected)
+		return 0;
+	if (!zet017_group_arrive(request))
+		return 0;
+
+	if (zet017_wakeup_drain(device) != 0)
+		return 0;
+
+	request->result = zet017_command_start_send(device, request->args.dac, &device->command.data);
+	request->sent = 1;
+
+	return 1;
+}
+
+// The worker itself only streams. Anything that waits for the device is passed to the control pool.
+// Returns 1 when the device is to be visited again before the next wait.
+static int zet017_worker_step(struct zet017_worker* worker, struct zet017_device* device, union zet017_packet* packet) {
+	uint32_t control = atomic_load_u32(&device->control);
+	if (control == zet017_control_running)
+		return 0;
+	if (control == zet017_control_done)
+		zet017_control_finish(worker, device);
+
+	if (!device->is_connected) {
+		if (zet017_connect_pending(device)) {
+			zet017_control_start(worker, device, 1);
+			return 0;
+		}
+		(void)zet017_wakeup_drain(device);
+		zet017_process_command(device);
+		return 0;
+	}
+
+	if (zet017_worker_send_start(worker, device))
+		return 1;
+
+	if (zet017_command_ready(device) || zet017_info_due(device)) {
+		zet017_control_start(worker, device, 0);
+		return 0;
+	}
+
+	zet017_process_adc_dac(device, packet, 0);
+
+	zet017_publish_state(device);
+
+	return 0;
+}
+
+// A control thread has finished, its device is due for a visit.
+static void zet017_worker_returned(struct zet017_worker* worker) {
+	(void)zet017_signal_drain(worker->signal);
+	for (struct zet017_device* device = worker->devices; device != NULL; device = device->worker_next) {
+		if (atomic_load_u32(&device->control) == zet017_control_done)
+			device->worker_ready = 1;
+	}
+}
+
+static void zet017_worker_wait(struct zet017_worker* worker) {
+#if defined(ZET017_TCP_EPOLL)
+	struct epoll_event ready[ZET017_WORKER_MAX_EVENTS];
+	int r = epoll_wait(worker->events_fd, ready, ZET017_WORKER_MAX_EVENTS, ZET017_WORKER_TIMEOUT);
+
+	// A device may have been removed after the wait returned, so only devices still owned are marked.
+	mutex_lock(&worker->mutex);
+	for (int i = 0; i < r; ++i) {
+		if (ready[i].data.ptr == NULL) {
+			zet017_worker_returned(worker);
+			continue;
+		}
+		for (struct zet017_device* device = worker->devices; device != NULL; device = device->worker_next) {
+			if (device == ready[i].data.ptr) {
+				device->worker_ready = 1;
+				break;
+			}
+		}
+	}
+	mutex_unlock(&worker->mutex);
+#else
+	// poll() rather than select(): no limit on the number or the value of the descriptors.
+	mutex_lock(&worker->mutex);
+	uint32_t size = 1 + worker->device_count * zet017_event_count;
+	if (size > worker->poll_size) {
+		pollfd_t* polls = realloc(worker->polls, size * sizeof(pollfd_t));
+		if (polls != NULL)
+			worker->polls = polls;
+		struct zet017_device** devices = realloc(worker->poll_devices, size * sizeof(struct zet017_device*));
+		if (devices != NULL)
+			worker->poll_devices = devices;
+		if (polls != NULL && devices != NULL)
+			worker->poll_size = size;
+	}
+
+	uint32_t count = 0;
+	if (worker->poll_size != 0) {
+		zet017_poll_set(&worker->polls[0], worker->signal[1], ZET017_EVENT_READ);
+		worker->poll_devices[0] = NULL;
+		count = 1;
+		for (struct zet017_device* device = worker->devices; device != NULL && count < worker->poll_size; device = device->worker_next) {
+			if (atomic_load_u32(&device->control) != zet017_control_idle)
+				continue;
+			for (uint32_t i = 0; i < zet017_event_count && count < worker->poll_size; ++i) {
+				if (device->events.interest[i] == 0)
+					continue;
+				zet017_poll_set(&worker->polls[count], device->events.socket[i], device->events.interest[i]);
+				worker->poll_devices[count++] = device;
+			}
+		}
+	}
+	mutex_unlock(&worker->mutex);
+
+	if (count == 0) {
+		thread_sleep(ZET017_WORKER_TIMEOUT);
+		return;
+	}
+
+	int r = poll_sockets(worker->polls, count, ZET017_WORKER_TIMEOUT);
+	if (r <= 0)
+		return;
+
+	mutex_lock(&worker->mutex);
+	if (worker->polls[0].revents != 0)
+		zet017_worker_returned(worker);
+	for (uint32_t i = 1; i < count; ++i) {
+		if (worker->polls[i].revents == 0)
+			continue;
+		for (struct zet017_device* device = worker->devices; device != NULL; device = device->worker_next) {
+			if (device == worker->poll_devices[i]) {
+				device->worker_ready = 1;
+				break;
+			}
+		}
+	}
+	mutex_unlock(&worker->mutex);
+#endif
+}
+
+enum zet017_worker_pass {
+	zet017_pass_ready,
+	zet017_pass_all,
+	zet017_pass_send
+};
+
+// Steps the devices with something to do, or all of them; returns whether a group start was sent.
+// The device being stepped is marked current, so it stays linked and the mutex is free meanwhile.
+static int zet017_worker_pass(struct zet017_worker* worker, enum zet017_worker_pass pass, union zet017_packet* packet) {
+	int sent = 0;
+	for (struct zet017_device* device = worker->devices; device != NULL; device = device->worker_next) {
+		if (pass == zet017_pass_ready && !device->worker_ready)
+			continue;
+
+		if (pass != zet017_pass_send)
+			device->worker_ready = 0;
+		worker->current = device;
+		mutex_unlock(&worker->mutex);
+
+		int revisit = pass == zet017_pass_send ? zet017_worker_send_start(worker, device) : zet017_worker_step(worker, device, packet);
+
+		mutex_lock(&worker->mutex);
+		worker->current = NULL;
+		cond_broadcast(&worker->cond);
+		if (revisit) {
+			device->worker_ready = 1;
+			sent = 1;
+		}
+	}
+
+	return sent;
+}
+
+static THREAD_RETURN zet017_worker_thread_func(void* arg) {
+	struct zet017_worker* worker = (struct zet017_worker*)arg;
+	union zet017_packet packet;
+
+	while (worker->running) {
+		zet017_worker_wait(worker);
+
+		// Idle and disconnected devices are visited at least every ZET017_WORKER_TIMEOUT ms,
+		// the same pace as the reconnect loop of a dedicated device thread.
+		uint32_t timestamp = zet017_get_timestamp();
+		enum zet017_worker_pass pass = zet017_pass_ready;
+		if (timestamp - worker->timestamp >= ZET017_WORKER_TIMEOUT) {
+			worker->timestamp = timestamp;
+			pass = zet017_pass_all;
+		}
+
+		// A group start sent for one device is looked for on all of them before any reply is waited for:
+		// the wakeups of the other members may not have reached the wait yet.
+		mutex_lock(&worker->mutex);
+		int sent = zet017_worker_pass(worker, pass, &packet);
+		while (sent) {
+			(void)zet017_worker_pass(worker, zet017_pass_send, &packet);
+			sent = zet017_worker_pass(worker, zet017_pass_ready, &packet);
+		}
+		mutex_unlock(&worker->mutex);
+	}
+
+#if defined(ZET017_TCP_WINDOWS)
+	return 0;
+#else
+	return NULL;
+#endif
+}
+
+static void zet017_worker_stop(struct zet017_worker* worker) {
+	if (worker->running) {
+		worker->running = 0;
+#if defined(ZET017_TCP_WINDOWS)
+		WaitForSingleObject(worker->thread, INFINITE);
+		CloseHandle(worker->thread);
+#else
+		pthread_join(worker->thread, NULL);
+#endif
+	}
+#if defined(ZET017_TCP_EPOLL)
+	if (worker->events_fd != -1)
+		close(worker->events_fd);
+#else
+	free(worker->polls);
+	free(worker->poll_devices);
+#endif
+	zet017_signal_close(worker->signal);
+	cond_destroy(&worker->cond);
+	mutex_destroy(&worker->mutex);
+}
+
+static int zet017_worker_start(struct zet017_worker* worker) {
+	memset(worker, 0x0, sizeof(struct zet017_worker));
+	worker->signal[0] = worker->signal[1] = INVALID_SOCKET;
+#if defined(ZET017_TCP_EPOLL)
+	worker->events_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (worker->events_fd == -1)
+		return -1;
+#endif
+	if (0 != mutex_init(&worker->mutex)) {
+#if defined(ZET017_TCP_EPOLL)
+		close(worker->events_fd);
+#endif
+		return -1;
+	}
+	if (0 != cond_init(&worker->cond)) {
+		mutex_destroy(&worker->mutex);
+#if defined(ZET017_TCP_EPOLL)
+		close(worker->events_fd);
+#endif
+		return -1;
+	}
+
+	int r = zet017_signal_open(worker->signal);
+#if defined(ZET017_TCP_EPOLL)
+	if (r == 0) {
+		struct epoll_event event;
+		memset(&event, 0x0, sizeof(event));
+		event.events = EPOLLIN;
+		event.data.ptr = NULL;
+		r = epoll_ctl(worker->events_fd, EPOLL_CTL_ADD, worker->signal[1], &event);
+	}
+#endif
+	if (r != 0) {
+		zet017_worker_stop(worker);
+		return -1;
+	}
+
+	worker->running = 1;
+#if defined(ZET017_TCP_WINDOWS)
+	worker->thread = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE)zet017_worker_thread_func, worker, 0, NULL);
+	if (worker->thread == NULL)
+#else
+	if (0 != pthread_create(&worker->thread, NULL, zet017_worker_thread_func, worker))
+#endif
+	{
+		worker->running = 0;
+		zet017_worker_stop(worker);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int zet017_worker_add_device(struct zet017_worker* worker, struct zet017_device* device) {
+	mutex_lock(&worker->mutex);
+
+#if defined(ZET017_TCP_EPOLL)
+	struct epoll_event event;
+	memset(&event, 0x0, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.ptr = device;
+	if (epoll_ctl(worker->events_fd, EPOLL_CTL_ADD, device->events.fd, &event) != 0) {
+		mutex_unlock(&worker->mutex);
+		return -1;
+	}
+#endif
+	device->worker = worker;
+	device->worker_next = worker->devices;
+	worker->devices = device;
+	++worker->device_count;
+
+	mutex_unlock(&worker->mutex);
+
+	return 0;
+}
+
+static uint32_t zet017_get_cpu_count(void) {
+#if defined(ZET017_TCP_WINDOWS)
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors ? (uint32_t)info.dwNumberOfProcessors : 1;
+#else
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return count > 0 ? (uint32_t)count : 1;
+#endif
+}
+
+ZET017_TCP_API zet017_server_create(struct zet017_server** server_ptr) {
+	if (!server_ptr)
+		return -1;
+
+	if (0 != network_init())
+		return -2;
+
+	zet017_convert_setup();
+
+	struct zet017_server* server = cache_aligned_alloc(sizeof(struct zet017_server));
+	if (!server) {
+		network_cleanup();
+		return -3;
+	}
+
+	memset(server, 0, sizeof(struct zet017_server));
+	server->devices = NULL;
+	server->device_count = 0;
+	if (0 != mutex_init(&server->devices_mutex)) {
+		cache_aligned_free(server);
+		network_cleanup();
+		return -4;
+	}
+	if (0 != mutex_init(&server->group_mutex)) {
+		mutex_destroy(&server->devices_mutex);
+		cache_aligned_free(server);
+		network_cleanup();
+		return -4;
+	}
+
+	*server_ptr = server;
+
+	return 0;
+}
+
+ZET017_TCP_API zet017_server_free(struct zet017_server** server_ptr) {
+	if (!server_ptr)
+		return -1;
+
+	struct zet017_server* server = *server_ptr;
+
+	if (!server)
+		return -2;
+
+	mutex_lock(&server->devices_mutex);
+	struct zet017_device* current = server->devices;
+	server->devices = NULL;
+	server->device_count = 0;
+	struct zet017_registry* registry = server->registry;
+	atomic_store_ptr((void* volatile*)&server->registry, NULL);
+	zet017_registry_synchronize(server);
+	free(registry);
+	mutex_unlock(&server->devices_mutex);
+	mutex_destroy(&server->devices_mutex);
+	mutex_destroy(&server->group_mutex);
+
+	while (current != NULL) {
+		struct zet017_device* next = current->next;
+		zet017_device_destroy(current);
+		current = next;
+	}
+
+	if (server->worker_count != 0)
+		zet017_control_stop(&server->control);
+	for (uint32_t i = 0; i < server->worker_count; ++i)
+		zet017_worker_stop(&server->workers[i]);
+	free(server->workers);
+
+	free(server->cache_dir);
+	cache_aligned_free(server);
+	*server_ptr = NULL;
+
+	network_cleanup();
+
+	return 0;
+}
+
+ZET017_TCP_API zet017_server_set_io_threads(struct zet017_server* server, uint32_t count) {
+	if (!server)
+		return -1;
+
+	mutex_lock(&server->devices_mutex);
+
+	if (server->device_count != 0 || server->worker_count != 0) {
+		mutex_unlock(&server->devices_mutex);
+		return -2;
+	}
+
+	if (count == ZET017_IO_THREADS_AUTO)
+		count = zet017_get_cpu_count();
+	if (count == 0) {
+		mutex_unlock(&server->devices_mutex);
+		return 0;
+	}
+
+	server->workers = malloc(count * sizeof(struct zet017_worker));
+	if (!server->workers) {
+		mutex_unlock(&server->devices_mutex);
+		return -3;
+	}
+
+	for (; server->worker_count < count; ++server->worker_count) {
+		if (zet017_worker_start(&server->workers[server->worker_count]) != 0)
+			break;
+	}
+	uint32_t control_count = count * ZET017_CONTROL_THREADS_PER_WORKER;
+	if (control_count < ZET017_CONTROL_THREADS_MIN)
+		control_count = ZET017_CONTROL_THREADS_MIN;
+	if (server->worker_count != count || zet017_control_start_pool(&server->control, control_count) != 0) {
+		for (uint32_t i = 0; i < server->worker_count; ++i)
+			zet017_worker_stop(&server->workers[i]);
+		free(server->workers);
+		server->workers = NULL;
+		server->worker_count = 0;
+		mutex_unlock(&server->devices_mutex);
+		return -4;
+	}
+
+	mutex_unlock(&server->devices_mutex);
+
+	return 0;
+}
+
+ZET017_TCP_API zet017_server_set_cache_dir(struct zet017_server* server, const char* path) {
+	if (!server)
+		return -1;
+
+	mutex_lock(&server->devices_mutex);
+
+	if (server->device_count != 0) {
+		mutex_unlock(&server->devices_mutex);
+		return -2;
+	}
+
+	char* cache_dir = NULL;
+	if (path != NULL && path[0] != '\0') {
+		cache_dir = malloc(strlen(path) + 1);
+		if (!cache_dir) {
+			mutex_unlock(&server->devices_mutex);
+			return -3;
+		}
+		strcpy(cache_dir, path);
+	}
+
+	free(server->cache_dir);
+	server->cache_dir = cache_dir;
+
+	mutex_unlock(&server->devices_mutex);
+
+	return 0;
+}
+
+ZET017_TCP_API zet017_server_add_device(struct zet017_server* server, const char* ip) {
+	return zet017_server_add_device_ex(server, ip, NULL);
+}
+
+ZET017_TCP_API zet017_server_add_device_ex(struct zet017_server* server, const char* ip, const struct zet017_device_params* params) {
+	if (!server)
+		return -1;
+
+	if (!ip)
+		return -2;
+
+	if (params && (params->adc_seconds < 0. || params->dac_seconds < 0.))
+		return -6;
+
+	mutex_lock(&server->devices_mutex);
+
+	if (zet017_registry_find_ip(server->registry, ip) >= 0) {
+		mutex_unlock(&server->devices_mutex);
+		return -3;
+	}
+
+	struct zet017_device* device = cache_aligned_alloc(sizeof(struct zet017_device));
+	if (!device) {
+		mutex_unlock(&server->devices_mutex);
+		return -4;
+	}
+
+	for (;;) {
+		memset(device, 0, sizeof(struct zet017_device));
+		strncpy(device->ip, ip, MAX_IP_LENGTH - 1);
+		device->ip[MAX_IP_LENGTH - 1] = '\0';
+		strncpy(device->info.ip, ip, MAX_IP_LENGTH - 1);
+		device->info.ip[MAX_IP_LENGTH - 1] = '\0';
+		device->cmd_socket = device->adc_socket = device->dac_socket = INVALID_SOCKET;
+		device->wakeup_socket[0] = device->wakeup_socket[1] = INVALID_SOCKET;
+		device->notify.signal[0] = device->notify.signal[1] = INVALID_SOCKET;
+		device->is_connected = 0;
+		device->server = server;
+		// Numbers are handed out in order and not reused; after a wrap-around the ones still held are skipped.
+		while (zet017_registry_find_number(server->registry, server->next_number) >= 0)
+			++server->next_number;
+		device->number = server->next_number;
+		device->adc_dac_data.dac_window_ms = ZET017_DAC_WINDOW_DEFAULT_MS;
+		device->connect_timeout = ZET017_CONNECT_TIMEOUT;
+		device->connect.min_interval = ZET017_RECONNECT_MIN_INTERVAL;
+		device->connect.max_interval = ZET017_RECONNECT_MAX_INTERVAL;
+		device->connect.seed = (uint32_t)(uintptr_t)device ^ zet017_get_timestamp();
+		if (device->connect.seed == 0)
+			device->connect.seed = 1;
+		if (params)
+			device->params = *params;
+		if (0 != zet017_events_init(&device->events))
+			break;
+		if (0 != zet017_wakeup_socket_init(device))
+			break;
+		device->receive.buffer = malloc(ZET017_RECEIVE_BUFFER_SIZE);
+		if (!device->receive.buffer)
+			break;
+		device->receive.size = device->receive.request = ZET017_RECEIVE_BUFFER_SIZE;
+		if (0 != mutex_init(&device->state_mutex))
+			break;
+		if (0 != mutex_init(&device->info_mutex))
+			break;
+		if (0 != mutex_init(&device->config_mutex))
+			break;
+		if (0 != mutex_init(&device->command.mutex))
+			break;
+		if (0 != mutex_init(&device->dac_data.mutex))
+			break;
+		if (0 != mutex_init(&device->dac_data.callback_mutex))
+			break;
+		if (0 != mutex_init(&device->adc_data.callback_mutex))
+			break;
+		if (0 != mutex_init(&device->connect.mutex))
+			break;
+		if (0 != cond_init(&device->connect.cond))
+			break;
+		if (0 != mutex_init(&device->notify.mutex))
+			break;
+		if (0 != cond_init(&device->notify.cond))
+			break;
+
+		// Marks the device alive; a pooled device goes to the control pool only when there is something to do.
+		device->running = 1;
+		if (server->worker_count != 0) {
+			struct zet017_worker* worker = &server->workers[0];
+			for (uint32_t i = 1; i < server->worker_count; ++i) {
+				if (server->workers[i].device_count < worker->device_count)
+					worker = &server->workers[i];
+			}
+			if (0 != zet017_worker_add_device(worker, device)) {
+				device->running = 0;
+				break;
+			}
+		}
+		else {
+#if defined(ZET017_TCP_WINDOWS)
+			device->work_thread = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE)zet017_device_thread_func, device, 0, NULL);
+			if (device->work_thread == NULL)
+#else
+			if (0 != pthread_create(&device->work_thread, NULL, zet017_device_thread_func, device))
+#endif
+			{
+				device->running = 0;
+				break;
+			}
+		}
+		if (server->devices == NULL)
+			server->devices = device;
+		else {
+			for (struct zet017_device* d = server->devices; d != NULL; d = d->next) {
+				if (d->next == NULL) {
+					d->next = device;
+					break;
+				}
+			}
+		}
+		++server->device_count;
+
+		if (zet017_registry_publish(server) != 0) {
+			// Not visible through the API, so the device is unlinked and dropped again.
+			for (struct zet017_device** link = &server->devices; *link != NULL; link = &(*link)->next) {
+				if (*link == device) {
+					*link = NULL;
+					break;
+				}
+			}
+			--server->device_count;
+			break;
+		}
+
+		++server->next_number;
+		mutex_unlock(&server->devices_mutex);
+
+		return 0;
+	}
+
+	zet017_device_destroy(device);
+
+	mutex_unlock(&server->devices_mutex);
+
+	return -5;
+}
 
-	int r = select(nfds + 1, &rfds, &wfds, NULL, &tv);
-	if (r == -1 || r == 0)
+ZET017_TCP_API zet017_server_remove_device(struct zet017_server* server, const char* ip) {
+	if (!server)
 		return -1;
 
-	if (FD_ISSET(device->wakeup_socket[1], &rfds)) {
-		char buf;
-		recv(device->wakeup_socket[1], &buf, 1, 0);
+	if (!ip)
 		return -2;
-	}
 
-	if (FD_ISSET(device->cmd_socket, &wfds)) {
-		r = send(device->cmd_socket, packet->raw, sizeof(*packet), 0);
-		if (r != sizeof(*packet))
-			return -2;
+	mutex_lock(&server->devices_mutex);
+
+	int index = zet017_registry_find_ip(server->registry, ip);
+	if (index < 0) {
+		mutex_unlock(&server->devices_mutex);
+		return -1;
 	}
-	else
+
+	struct zet017_device* device = server->registry->devices[index];
+	struct zet017_device** link = &server->devices;
+	while (*link != device)
+		link = &(*link)->next;
+	*link = device->next;
+	--server->device_count;
+
+	if (zet017_registry_publish(server) != 0) {
+		*link = device;
+		++server->device_count;
+		mutex_unlock(&server->devices_mutex);
 		return -3;
+	}
+	zet017_registry_synchronize(server);
 
-	int data_ptr = 0;
-	for (;;) {
-		FD_ZERO(&rfds);
-		FD_SET(device->wakeup_socket[1], &rfds);
-		FD_SET(device->cmd_socket, &rfds);
+	mutex_unlock(&server->devices_mutex);
 
-		r = select(nfds + 1, &rfds, NULL, NULL, &tv);
-		if (r == -1 || r == 0)
-			break;
+	// No API call can reach the device anymore, its thread is stopped without holding the registry.
+	zet017_device_destroy(device);
 
-		if (FD_ISSET(device->wakeup_socket[1], &rfds)) {
-			char buf;
-			recv(device->wakeup_socket[1], &buf, 1, 0);
-			break;
-		}
+	return 0;
+}
 
-		if (FD_ISSET(device->cmd_socket, &rfds)) {
-			int len = sizeof(*packet) - data_ptr;
-			r = recv(device->cmd_socket, packet->raw + data_ptr, len, 0);
-			if (r <= 0)
-				break;
+ZET017_TCP_API zet017_server_find_device(struct zet017_server* server, const char* ip, uint32_t* number) {
+	if (!server)
+		return -1;
 
-			data_ptr += r;
-			if (data_ptr == sizeof(*packet))
-				return 0;
-		}
+	if (!ip || !number)
+		return -2;
+
+	uint32_t epoch = zet017_registry_enter(server);
+	struct zet017_registry* registry = atomic_load_ptr((void* volatile*)&server->registry);
+	int index = zet017_registry_find_ip(registry, ip);
+	if (index >= 0)
+		*number = registry->devices[index]->number;
+	zet017_registry_leave(server, epoch);
+
+	return index >= 0 ? 0 : -3;
+}
+
+ZET017_TCP_API zet017_server_find_device_by_serial(struct zet017_server* server, uint32_t serial, uint32_t* number) {
+	if (!server)
+		return -1;
+
+	if (!number || serial == 0)
+		return -2;
+
+	uint32_t epoch = zet017_registry_enter(server);
+	struct zet017_registry* registry = atomic_load_ptr((void* volatile*)&server->registry);
+	int index = zet017_registry_find_serial(registry, serial);
+	if (index >= 0)
+		*number = registry->devices[index]->number;
+	zet017_registry_leave(server, epoch);
+
+	// A serial reported after the snapshot was taken is not indexed yet, the snapshot is rebuilt.
+	// This waits for devices_mutex, so it is done outside the reader section.
+	if (index < 0 && atomic_load_u32(&server->registry_stale)) {
+		mutex_lock(&server->devices_mutex);
+		if (atomic_load_u32(&server->registry_stale))
+			(void)zet017_registry_publish(server);
+		index = zet017_registry_find_serial(server->registry, serial);
+		if (index >= 0)
+			*number = server->registry->devices[index]->number;
+		mutex_unlock(&server->devices_mutex);
 	}
 
-	return -4;
+	return index >= 0 ? 0 : -3;
 }
 
-static void zet017_device_update_info(struct zet017_device* device, union zet017_packet* packet) {
-	memcpy(&device->device_info, &packet->info, sizeof(struct zet017_device_info));
+static int zet017_device_get_info_impl(struct zet017_server* server, uint32_t number, struct zet017_info* info) {
+	if (!info)
+		return -1;
 
-	device->adc_dac_data.sample_rate_adc = zet017_get_sample_rate_adc(device->device_info.mode_adc);
-	device->adc_dac_data.work_channel_adc = device->device_info.work_channel_adc;
-	device->adc_dac_data.sample_size_adc =
-		(uint16_t)(device->device_info.type_data_adc == 0 ? sizeof(int16_t) : sizeof(int32_t));
-	device->adc_dac_data.sample_rate_dac = zet017_get_sample_rate_dac(device->device_info.rate_dac);
-	device->adc_dac_data.work_channel_dac = device->device_info.work_channel_dac;
-	device->adc_dac_data.sample_size_dac =
-		(uint16_t)(device->device_info.type_data_dac == 0 ? sizeof(int16_t) : sizeof(int32_t));
+	struct zet017_device* device = zet017_get_device(server, number);
+	if (device == NULL)
+		return -2;
 
 	mutex_lock(&device->info_mutex);
-	strcpy(device->info.name, device->device_info.device_name);
-	device->info.serial = device->device_info.serial;
-	strcpy(device->info.version, device->device_info.version_dsp);
+	memcpy(info, &device->info, sizeof(struct zet017_info));
 	mutex_unlock(&device->info_mutex);
 
-	mutex_lock(&device->config_mutex);
-	device->config.sample_rate_adc = zet017_get_sample_rate_adc(device->device_info.mode_adc);
-	device->config.moda_adc = device->device_info.mode_adc;
-	device->config.sample_rate_dac = zet017_get_sample_rate_dac(device->device_info.rate_dac);
-	device->config.rate_dac = device->device_info.rate_dac;
-	device->config.mask_channel_adc = device->device_info.mask_channel_adc;
-	device->config.mask_icp = device->device_info.mask_icp;
-	for (uint32_t i = 0; i < 8; ++i) {
-		device->config.gain[i] = zet017_get_gain(device->device_info.amplify_code[i]);
-		device->config.gain_code[i] = device->device_info.amplify_code[i];
-	}
-	if (device->device_info.quantity_channel_adc == 4) {
-		device->config.mask_channel_adc =
-			((device->device_info.mask_channel_adc & 0x02) >> 1) +
-			((device->device_info.mask_channel_adc & 0x08) >> 2) +
-			((device->device_info.mask_channel_adc & 0x20) >> 3) +
-			((device->device_info.mask_channel_adc & 0x80) >> 4);
-		device->config.mask_icp =
-			((device->device_info.mask_icp & 0x02) >> 1) +
-			((device->device_info.mask_icp & 0x08) >> 2) +
-			((device->device_info.mask_icp & 0x20) >> 3) +
-			((device->device_info.mask_icp & 0x80) >> 4);
-		for (uint32_t i = 0; i < 4; ++i) {
-			device->config.gain[i] = zet017_get_gain(device->device_info.amplify_code[i * 2 + 1]);
-			device->config.gain_code[i] = device->device_info.amplify_code[i * 2 + 1];
-		}
-	}
-	device->config.builtin_dac_state = device->device_info.builtin_dac_state;
-	device->config.builtin_dac_sine_freq = (double)device->device_info.builtin_dac_sine_freq;
-	device->config.builtin_dac_sine_ampl = (double)device->device_info.builtin_dac_sine_ampl;
-	device->config.builtin_dac_sine_offset = (double)device->device_info.builtin_dac_sine_offset;
-	if (device->device_info.resolution_dac[0]) {
-		device->config.builtin_dac_sine_ampl *= device->device_info.resolution_dac[0];
-		device->config.builtin_dac_sine_offset *= device->device_info.resolution_dac[0];
-	}
-	else {
-		device->config.builtin_dac_sine_ampl *= device->device_info.resolution_dac_def;
-		device->config.builtin_dac_sine_offset *= device->device_info.resolution_dac_def;
-	}
-	mutex_unlock(&device->config_mutex);
+	return 0;
+}
+
+ZET017_TCP_API zet017_device_get_info(struct zet017_server* server, uint32_t number, struct zet017_info* info) {
+	uint32_t epoch = zet017_registry_enter(server);
+	int r = zet017_device_get_info_impl(server, number, info);
+	zet017_registry_leave(server, epoch);
+
+	return r;
+}
+
+static int zet017_device_get_state_impl(struct zet017_server* server, uint32_t number, struct zet017_state* state) {
+	if (!state)
+		return -1;
+
+	struct zet017_device* device = zet017_get_device(server, number);
+	if (device == NULL)
+		return -2;
 
 	mutex_lock(&device->state_mutex);
-	uint32_t sample_size = (uint32_t)(device->device_info.type_data_adc == 0 ? sizeof(int16_t) : sizeof(int32_t));
-	device->state.buffer_size_adc = ZET017_ADC_BUFFER_SIZE / sample_size / device->device_info.work_channel_adc;
-	sample_size = (uint32_t)(device->device_info.type_data_dac == 0 ? sizeof(int16_t) : sizeof(int32_t));
-	device->state.buffer_size_dac = ZET017_DAC_BUFFER_SIZE / sample_size;
-	if (device->device_info.work_channel_dac != 0)
-		device->state.buffer_size_dac /= device->device_info.work_channel_dac;
+
+	memcpy(state, &device->state, sizeof(struct zet017_state));
+
 	mutex_unlock(&device->state_mutex);
+
+	return 0;
 }
 
-static void zet017_device_update_tenso_info(struct zet017_device* device, union zet017_packet* packet) {
-	memcpy(&device->tenso_info, packet->cmd.data.u8, sizeof(struct zet017_tenso_info));
-	for (uint32_t i = 0; i < 8; ++i) {
-		device->tenso_config.scheme[i] = (enum zet017_scheme)device->tenso_info.scheme[i];
-		device->tenso_config.correction_1[i] = device->tenso_info.correction[i][0];
-		device->tenso_config.correction_2[i] = device->tenso_info.correction[i][1];
-	}
+ZET017_TCP_API zet017_device_get_state(struct zet017_server* server, uint32_t number, struct zet017_state* state) {
+	uint32_t epoch = zet017_registry_enter(server);
+	int r = zet017_device_get_state_impl(server, number, state);
+	zet017_registry_leave(server, epoch);
+
+	return r;
 }
 
-static void zet017_device_update_adc_dac_info(struct zet017_device* device) {
-	mutex_lock(&device->adc_data.mutex);
+static int zet017_device_set_receive_buffer_impl(struct zet017_server* server, uint32_t number, uint32_t size) {
+	if (size < ZET017_PACKET_SIZE || size > ZET017_MAX_RECEIVE_BUFFER_SIZE)
+		return -1;
+
+	struct zet017_device* device = zet017_get_device(server, number);
+	if (device == NULL)
+		return -2;
+
+	// Applied by the device thread before its next receive.
+	atomic_store_u32(&device->receive.request, size - size % ZET017_PACKET_SIZE);
+
+	return 0;
+}
+
+ZET017_TCP_API zet017_device_set_receive_buffer(struct zet017_server* server, uint32_t number, uint32_t size) {
+	uint32_t epoch = zet017_registry_enter(server);
+	int r = zet017_device_set_receive_buffer_impl(server, number, size);
+	zet017_registry_leave(server, epoch);
+
+	return r;
+}
+
+static int zet017_device_set_connect_timeout_impl(struct zet017_server* server, uint32_t number, uint32_t timeout_ms) {
+	if (timeout_ms == 0 || timeout_ms > ZET017_CONNECT_TIMEOUT_MAX)
+		return -1;
+
+	struct zet017_device* device = zet017_get_device(server, number);
+	if (device == NULL)
+		return -2;
+
+	atomic_store_u32(&device->connect_timeout, timeout_ms);
+
+	return 0;
+}
+
+ZET017_TCP_API zet017_device_set_connect_timeout(struct zet017_server* server, uint32_t number, uint32_t timeout_ms) {
+	uint32_t epoch = zet017_registry_enter(server);
+	int r = zet017_device_set_connect_timeout_impl(server, number, timeout_ms);
+	zet017_registry_leave(server, epoch);
+
+	return r;
+}
+
+static int zet017_device_set_reconnect_policy_impl(
+	struct zet017_server* server, uint32_t number, uint32_t min_interval_ms, uint32_t max_interval_ms) {
+	if (min_interval_ms == 0 || max_interval_ms < min_interval_ms || max_interval_ms > ZET017_RECONNECT_INTERVAL_MAX)
+		return -1;
+
+	struct zet017_device* device = zet017_get_device(server, number);
+	if (device == NULL)
+		return -2;
+
+	mutex_lock(&device->connect.mutex);
+	device->connect.min_interval = min_interval_ms;
+	device->connect.max_interval = max_interval_ms;
+	if (device->connect.backoff > max_interval_ms)
+		device->connect.backoff = max_interval_ms;
+	mutex_unlock(&device->connect.mutex);
+
+	return 0;
+}
+
+ZET017_TCP_API zet017_device_set_reconnect_policy(
+	struct zet017_server* server, uint32_t number, uint32_t min_interval_ms, uint32_t max_interval_ms) {
+	uint32_t epoch = zet017_registry_enter(server);
+	int r = zet017_device_set_reconnect_policy_impl(server, number, min_interval_ms, max_interval_ms);
+	zet017_registry_leave(server, epoch);
+
+	return r;
+}
+
+static int zet017_device_reconnect_now_impl(struct zet017_server* server, uint32_t number) {
+	struct zet017_device* device = zet017_get_device(server, number);
+	if (device == NULL)
+		return -1;
+
+	// Also restarts the backoff from the shortest interval.
+	mutex_lock(&device->connect.mutex);
+	device->connect.nudge = 1;
+	device->connect.backoff = 0;
+	cond_signal(&device->connect.cond);
+	mutex_unlock(&device->connect.mutex);
+
+	return 0;
+}
+
+ZET017_TCP_API zet017_device_reconnect_now(struct zet017_server* server, uint32_t number) {
+	uint32_t epoch = zet017_registry_enter(server);
+	int r = zet017_device_reconnect_now_impl(server, number);
+	zet017_registry_leave(server, epoch);
+
+	return r;
+}
+
+static int zet017_device_get_connect_stats_impl(struct zet017_server* server, uint32_t number, struct zet017_connect_stats* stats) {
+	if (!stats)
+		return -1;
+
+	struct zet017_device* device = zet017_get_device(server, number);
+	if (device == NULL)
+		return -2;
+
+	mutex_lock(&device->connect.mutex);
+	stats->attempts = device->connect.attempts;
+	stats->failures = device->connect.failures;
+	stats->last_error = device->connect.error;
+	stats->system_error = device->connect.system_error;
+	stats->last_connect_time = device->connect.last_time;
+	stats->backoff = device->connect.backoff;
+	memcpy(stats->histogram, device->connect.histogram, sizeof(stats->histogram));
+	mutex_unlock(&device->connect.mutex);
+
+	return 0;
+}
+
+ZET017_TCP_API zet017_device_get_connect_stats(struct zet017_server* server, uint32_t number, struct zet017_connect_stats* stats) {
+	uint32_t epoch = zet017_registry_enter(server);
+	int r = zet017_device_get_connect_stats_impl(server, number, stats);
+	zet017_registry_leave(server, epoch);
+
+	return r;
+}
+
+static int zet017_device_set_dac_underrun_policy_impl(
+	struct zet017_server* server, uint32_t number, enum zet017_dac_underrun policy) {
+	if (policy != zet017_dac_underrun_zero && policy != zet017_dac_underrun_hold)
+		return -1;
+
+	struct zet017_device* device = zet017_get_device(server, number);
+	if (device == NULL)
+		return -2;
+
+	mutex_lock(&device->dac_data.mutex);
+	device->dac_data.underrun = policy;
+	mutex_unlock(&device->dac_data.mutex);
+
+	return 0;
+}
 
-	device->adc_data.channel_quantity = device->device_info.quantity_channel_adc;
-	device->adc_data.work_channel = device->device_info.work_channel_adc;
-	device->adc_data.channel_mask = device->device_info.mask_channel_adc;
-	device->adc_data.sample_size = device->device_info.type_data_adc == 0 ? sizeof(int16_t) : sizeof(int32_t);
-	memcpy(device->adc_data.amplify_code, device->device_info.amplify_code, sizeof(device->device_info.amplify_code));
-	if (device->device_info.quantity_channel_virt)
-		device->adc_data.amplify_code[device->device_info.quantity_channel_adc - device->device_info.quantity_channel_virt] = 0;
-	if (device->device_info.quantity_channel_adc == 4) {
-		device->adc_data.channel_mask =
-			((device->device_info.mask_channel_adc & 0x02) >> 1) +
-			((device->device_info.mask_channel_adc & 0x08) >> 2) +
-			((device->device_info.mask_channel_adc & 0x20) >> 3) +
-			((device->device_info.mask_channel_adc & 0x80) >> 4);
-		for (uint32_t i = 0; i < 4; ++i)
-			device->adc_data.amplify_code[i] = device->device_info.amplify_code[i * 2 + 1];
-	}
+ZET017_TCP_API zet017_device_set_dac_underrun_policy(
+	struct zet017_server* server, uint32_t number, enum zet017_dac_underrun policy) {
+	uint32_t epoch = zet017_registry_enter(server);
+	int r = zet017_device_set_dac_underrun_policy_impl(server, number, policy);
+	zet017_registry_leave(server, epoch);
 
-	uint16_t quantity_channel_adc = device->device_info.quantity_channel_adc - device->device_info.quantity_channel_virt;
-	for (uint32_t i = 0; i < quantity_channel_adc; ++i) {
-		uint32_t* dummy = (uint32_t*)device->correction.amplify[i];
-		if (*dummy == 0) {
-			float resolution = device->device_info.resolution_adc_def;
-			dummy = (uint32_t*)(device->device_info.resolution_adc + i);
-			if (quantity_channel_adc == 4)
-				dummy = (uint32_t*)(device->device_info.resolution_adc + i + i + 1);
-			if (*dummy != 0)
-				resolution = *(float*)dummy;
-			device->adc_data.resolution[i][0] = resolution;
-			device->adc_data.resolution[i][1] = resolution / 10.f;
-			device->adc_data.resolution[i][2] = resolution / 100.f;
-		}
-		else {
-			device->adc_data.resolution[i][0] = *(float*)dummy;
-			device->adc_data.resolution[i][1] = device->adc_data.resolution[i][0] / device->correction.amplify[i][1];
-			device->adc_data.resolution[i][2] = device->adc_data.resolution[i][0] / device->correction.amplify[i][2];
-		}
-	}
-	if (device->device_info.quantity_channel_virt)
-	{
-		uint32_t* dummy = (uint32_t*)(device->correction.reduction);
-		if (*dummy == 0) {
-			float resolution = device->device_info.resolution_dac_def;
-			dummy = (uint32_t*)(device->device_info.resolution_dac);
-			if (*dummy != 0)
-				resolution = *(float*)dummy;
-			device->adc_data.resolution[quantity_channel_adc][0] = resolution;
-		}
-		else
-			device->adc_data.resolution[quantity_channel_adc][0] = *(float*)dummy;
-	}
+	return r;
+}
 
-	mutex_unlock(&device->adc_data.mutex);
+static int zet017_device_set_dac_callback_impl(
+	struct zet017_server* server, uint32_t number, zet017_dac_callback callback, void* context) {
+	struct zet017_device* device = zet017_get_device(server, number);
+	if (device == NULL)
+		return -1;
 
+	// Taken by the worker around every call, so the old callback is not running once this returns.
+	// The ring is not played while a callback feeds the DAC, so what it held goes either way:
+	// after the callback is cleared the output follows the underrun policy until new data is put.
+	mutex_lock(&device->dac_data.callback_mutex);
+	device->dac_data.callback = callback;
+	device->dac_data.context = context;
 	mutex_lock(&device->dac_data.mutex);
+	zet017_dac_next_epoch(&device->dac_data);
+	mutex_unlock(&device->dac_data.mutex);
+	mutex_unlock(&device->dac_data.callback_mutex);
 
-	device->dac_data.channel_quantity = device->device_info.work_channel_dac;
-	device->dac_data.channel_mask = device->device_info.mask_channel_dac;
-	device->dac_data.sample_size = device->device_info.type_data_dac == 0 ? sizeof(int16_t) : sizeof(int32_t);
+	return 0;
+}
 
-	uint16_t quantity_channel_dac = device->device_info.quantity_channel_dac;
-	for (uint32_t i = 0; i < quantity_channel_dac; ++i) {
-		uint32_t* dummy = (uint32_t*)(device->correction.reduction + i);
-		if (*dummy == 0) {
-			float resolution = device->device_info.resolution_dac_def;
-			dummy = (uint32_t*)(device->device_info.resolution_dac + i);
-			if (*dummy != 0)
-				resolution = *(float*)dummy;
-			device->dac_data.resolution[i] = resolution;
-		}
-		else
-			device->dac_data.resolution[i] = *(float*)dummy;
-	}
+ZET017_TCP_API zet017_device_set_dac_callback(
+	struct zet017_server* server, uint32_t number, zet017_dac_callback callback, void* context) {
+	uint32_t epoch = zet017_registry_enter(server);
+	int r = zet017_device_set_dac_callback_impl(server, number, callback, context);
+	zet017_registry_leave(server, epoch);
 
-	mutex_unlock(&device->dac_data.mutex);
+	return r;
 }
 
-static int zet017_device_get_info_cmd(struct zet017_device* device, union zet017_packet* packet) {
-	memset(packet, 0x0, sizeof(*packet));
-	packet->info.command = ZET017_CMD_GET_INFO;
-	if (zet017_device_process_command(device, packet) != 0)
+static int zet017_device_set_adc_callback_impl(
+	struct zet017_server* server, uint32_t number, zet017_adc_callback callback, void* context) {
+	struct zet017_device* device = zet017_get_device(server, number);
+	if (device == NULL)
 		return -1;
 
-	zet017_device_update_info(device, packet);
+	// Taken by the worker around every call, so the old callback is not running once this returns.
+	mutex_lock(&device->adc_data.callback_mutex);
+	device->adc_data.context = context;
+	atomic_store_ptr((void* volatile*)&device->adc_data.callback, (void*)callback);
+	mutex_unlock(&device->adc_data.callback_mutex);
 
 	return 0;
 }
 
-static int zet017_device_put_info_cmd(struct zet017_device* device, union zet017_packet* packet) {
-	packet->info.command = ZET017_CMD_PUT_INFO;
-	if (0 != zet017_device_process_command(device, packet))
+ZET017_TCP_API zet017_device_set_adc_callback(
+	struct zet017_server* server, uint32_t number, zet017_adc_callback callback, void* context) {
+	uint32_t epoch = zet017_registry_enter(server);
+	int r = zet017_device_set_adc_callback_impl(server, number, callback, context);
+	zet017_registry_leave(server, epoch);
+
+	return r;
+}
+
+static int zet017_device_set_dac_window_impl(struct zet017_server* server, uint32_t number, uint32_t ms) {
+	if (ms > ZET017_DAC_WINDOW_MAX_MS)
 		return -1;
-	
-	zet017_device_update_info(device, packet);
+
+	struct zet017_device* device = zet017_get_device(server, number);
+	if (device == NULL)
+		return -2;
+
+	atomic_store_u32(&device->adc_dac_data.dac_window_ms, ms);
+	zet017_device_wakeup(device);
 
 	return 0;
 }
 
-static int zet017_device_start_cmd(struct zet017_device* device, union zet017_packet* packet) {
-	packet->info.command = ZET017_CMD_PUT_INFO;
-	if (0 != zet017_device_process_command(device, packet))
-		return -1;
+ZET017_TCP_API zet017_device_set_dac_window(struct zet017_server* server, uint32_t number, uint32_t ms) {
+	uint32_t epoch = zet017_registry_enter(server);
+	int r = zet017_device_set_dac_window_impl(server, number, ms);
+	zet017_registry_leave(server, epoch);
 
-	memset(device->adc_data.buffer, 0x0, ZET017_ADC_BUFFER_SIZE);
-	device->adc_data.pointer = 0;
+	return r;
+}
 
-	memset(device->dac_data.buffer, 0x0, ZET017_DAC_BUFFER_SIZE);
-	device->dac_data.pointer = 0;
+static int zet017_device_get_dac_stats_impl(struct zet017_server* server, uint32_t number, struct zet017_dac_stats* stats) {
+	if (!stats)
+		return -1;
 
-	device->adc_dac_data.adc_count = 0;
-	device->adc_dac_data.dac_count = 0;
+	struct zet017_device* device = zet017_get_device(server, number);
+	if (device == NULL)
+		return -2;
 
-	zet017_device_update_info(device, packet);
+	stats->sent = atomic_load_u64(&device->adc_dac_data.dac_count);
+	stats->underrun = atomic_load_u64(&device->adc_dac_data.dac_underrun);
+	stats->late = atomic_load_u64(&device->adc_dac_data.dac_late);
+	stats->window = atomic_load_u32(&device->adc_dac_data.dac_window);
 
 	return 0;
 }
 
-static int zet017_device_stop_cmd(struct zet017_device* device, union zet017_packet* packet) {
-	for (;;) {
-		if (device->device_info.start_adc == 0)
-			return 0;
+ZET017_TCP_API zet017_device_get_dac_stats(struct zet017_server* server, uint32_t number, struct zet017_dac_stats* stats) {
+	uint32_t epoch = zet017_registry_enter(server);
+	int r = zet017_device_get_dac_stats_impl(server, number, stats);
+	zet017_registry_leave(server, epoch);
 
-		memcpy(&packet->info, &device->device_info, sizeof(struct zet017_device_info));
-		packet->info.command = ZET017_CMD_PUT_INFO;
-		packet->info.start_adc = -1;
-		if (packet->info.start_dac != 0)
-			packet->info.start_dac = -1;
-		if (0 != zet017_device_process_command(device, packet))
-			break;
+	return r;
+}
 
-		if (0 != zet017_device_wait_stop(device, packet))
-			break;
+static int zet017_device_get_config_impl(struct zet017_server* server, uint32_t number, struct zet017_config* config) {
+	if (!config)
+		return -1;
 
-		memcpy(&packet->info, &device->device_info, sizeof(struct zet017_device_info));
-		packet->info.command = ZET017_CMD_PUT_INFO;
-		packet->info.start_adc = 0;
-		packet->info.start_dac = 0;
-		if (0 != zet017_device_process_command(device, packet))
-			break;
+	struct zet017_device* device = zet017_get_device(server, number);
+	if (device == NULL)
+		return -2;
 
-		zet017_device_update_info(device, packet);
+	mutex_lock(&device->config_mutex);
+	memcpy(config, &device->config, sizeof(struct zet017_config));
+	mutex_unlock(&device->config_mutex);
 
-		return 0;
-	}
+	return 0;
+}
 
-	return -1;
+ZET017_TCP_API zet017_device_get_config(struct zet017_server* server, uint32_t number, struct zet017_config* config) {
+	uint32_t epoch = zet017_registry_enter(server);
+	int r = zet017_device_get_config_impl(server, number, config);
+	zet017_registry_leave(server, epoch);
+
+	return r;
 }
 
-static int zet017_device_read_correction_cmd(struct zet017_device* device, union zet017_packet* packet) {
-	for (;;) {
-		memset(&packet->cmd, 0x0, sizeof(struct zet017_command_info));
-		packet->cmd.command = ZET017_CMD_READ_CORRECTION;
-		packet->cmd.error = 1;
-		packet->cmd.size = sizeof(struct zet017_correction_info);
-		if (0 != zet017_device_process_command(device, packet))
-			break;
+static int zet017_device_get_tenso_config_impl(struct zet017_server* server, uint32_t number, struct zet017_tenso_config* config) {
+	if (!config)
+		return -1;
 
-		if (packet->cmd.command == ZET017_CMD_READ_CORRECTION)
-			memcpy(&device->correction, packet->cmd.data.u8, sizeof(struct zet017_correction_info));
-		else
-			memset(&device->correction, 0x0, sizeof(struct zet017_correction_info));
+	struct zet017_device* device = zet017_get_device(server, number);
+	if (device == NULL)
+		return -2;
 
-		return 0;
+	mutex_lock(&device->config_mutex);
+	memcpy(config, &device->tenso_config, sizeof(struct zet017_tenso_config));
+	mutex_unlock(&device->config_mutex);
+
+	return 0;
+}
+
+ZET017_TCP_API zet017_device_get_tenso_config(struct zet017_server* server, uint32_t number, struct zet017_tenso_config* config) {
+	uint32_t epoch = zet017_registry_enter(server);
+	int r = zet017_device_get_tenso_config_impl(server, number, config);
+	zet017_registry_leave(server, epoch);
+
+	return r;
+}
+
+static struct zet017_request* zet017_request_create(
+	enum zet017_command command, zet017_request_callback callback, void* context, int handle) {
+	struct zet017_request* request = (struct zet017_request*)calloc(1, sizeof(struct zet017_request));
+	if (request == NULL)
+		return NULL;
+
+	if (0 != mutex_init(&request->mutex)) {
+		free(request);
+		return NULL;
 	}
+	if (0 != cond_init(&request->cond)) {
+		mutex_destroy(&request->mutex);
+		free(request);
+		return NULL;
+	}
+	request->command = command;
+	request->callback = callback;
+	request->context = context;
+	// One reference for the queue and one for the caller's handle, if any.
+	request->refs = handle ? 2 : 1;
 
-	return -1;
+	return request;
 }
 
-static int zet017_device_read_tenso_cmd(struct zet017_device* device, union zet017_packet* packet) {
-	for (;;) {
-		memset(&packet->cmd, 0x0, sizeof(struct zet017_command_info));
-		packet->cmd.command = ZET017_CMD_READ_TENSO;
-		packet->cmd.error = 1;
-		packet->cmd.size = sizeof(struct zet017_tenso_info);
-		if (0 != zet017_device_process_command(device, packet))
-			break;
+static void zet017_device_submit(struct zet017_device* device, struct zet017_request* request) {
+	mutex_lock(&device->command.mutex);
+	if (device->command.tail != NULL)
+		device->command.tail->next = request;
+	else
+		device->command.head = request;
+	device->command.tail = request;
+	mutex_unlock(&device->command.mutex);
 
-		if (packet->cmd.command == ZET017_CMD_READ_TENSO)
-			zet017_device_update_tenso_info(device, packet);
-		else
-			memset(&device->tenso_info, 0x0, sizeof(struct zet017_tenso_info));
+	zet017_device_wakeup(device);
+}
 
-		return 0;
+static struct zet017_device* zet017_get_connected_device(struct zet017_server* server, uint32_t number, int* r) {
+	struct zet017_device* device = zet017_get_device(server, number);
+	if (device == NULL) {
+		*r = -1;
+		return NULL;
 	}
 
-	return -1;
+	mutex_lock(&device->state_mutex);
+	uint16_t is_connected = device->state.is_connected;
+	mutex_unlock(&device->state_mutex);
+	if (!is_connected) {
+		*r = -2;
+		return NULL;
+	}
+
+	return device;
 }
 
-static int zet017_device_write_tenso_cmd(struct zet017_device* device, union zet017_packet* packet) {
-	packet->cmd.command = ZET017_CMD_WRITE_TENSO;
-	packet->cmd.error = 1;
-	packet->cmd.size = sizeof(struct zet017_tenso_info);
-	if (0 != zet017_device_process_command(device, packet))
-		return -1;
+// The request holds its own reference and a removed device fails it, so blocking calls wait here
+// after leaving the reader section instead of holding off remove_device and server_free.
+static int zet017_request_result(struct zet017_request* request) {
+	int result = 0;
+	zet017_request_wait(request, ZET017_WAIT_INFINITE, &result);
+	zet017_request_free(&request);
 
-	zet017_device_update_tenso_info(device, packet);
+	return result;
+}
+
+static int zet017_device_set_config_async_impl(struct zet017_server* server, uint32_t number, const struct zet017_config* config,
+	zet017_request_callback callback, void* context, struct zet017_request** request) {
+	int r = 0;
+	struct zet017_device* device = zet017_get_connected_device(server, number, &r);
+	if (device == NULL)
+		return r;
+
+	if (!config)
+		return -3;
+
+	struct zet017_request* req = zet017_request_create(zet017_set_config, callback, context, request != NULL);
+	if (req == NULL)
+		return -4;
+	req->args.config = *config;
+
+	zet017_device_submit(device, req);
+	if (request != NULL)
+		*request = req;
 
 	return 0;
 }
 
-static int zet017_device_connect(struct zet017_device* device) {
-	for (;;) {
-		if (zet017_wakeup_socket_init(device) != 0)
-			break;
+ZET017_TCP_API zet017_device_set_config_async(struct zet017_server* server, uint32_t number, const struct zet017_config* config,
+	zet017_request_callback callback, void* context, struct zet017_request** request) {
+	uint32_t epoch = zet017_registry_enter(server);
+	int r = zet017_device_set_config_async_impl(server, number, config, callback, context, request);
+	zet017_registry_leave(server, epoch);
 
-		if (zet017_socket_cmd_connect(device) != 0)
-			break;
+	return r;
+}
 
-		if (zet017_socket_adc_connect(device) != 0)
-			break;
+ZET017_TCP_API zet017_device_set_config(
+	struct zet017_server* server, uint32_t number, const struct zet017_config* config) {
+	struct zet017_request* request = NULL;
+	uint32_t epoch = zet017_registry_enter(server);
+	int r = zet017_device_set_config_async_impl(server, number, config, NULL, NULL, &request);
+	zet017_registry_leave(server, epoch);
 
-		if (zet017_socket_dac_connect(device) != 0)
-			break;
+	if (r != 0)
+		return r;
 
-		memset(device->adc_data.buffer, 0x0, ZET017_ADC_BUFFER_SIZE);
-		device->adc_data.pointer = 0;
+	return zet017_request_result(request);
+}
 
-		memset(device->dac_data.buffer, 0x0, ZET017_DAC_BUFFER_SIZE);
-		device->dac_data.pointer = 0;
+static int zet017_device_set_tenso_config_async_impl(struct zet017_server* server, uint32_t number,
+	const struct zet017_tenso_config* config, zet017_request_callback callback, void* context, struct zet017_request** request) {
+	int r = 0;
+	struct zet017_device* device = zet017_get_connected_device(server, number, &r);
+	if (device == NULL)
+		return r;
 
-		device->adc_dac_data.adc_count = 0;
-		device->adc_dac_data.dac_count = 0;
+	if (!config)
+		return -3;
 
-		return 0;
-	}
+	struct zet017_request* req = zet017_request_create(zet017_write_tenso_config, callback, context, request != NULL);
+	if (req == NULL)
+		return -4;
+	req->args.tenso_config = *config;
 
-	zet017_device_close(device);
+	zet017_device_submit(device, req);
+	if (request != NULL)
+		*request = req;
 
-	return -1;
+	return 0;
 }
 
-static int zet017_device_init(struct zet017_device* device, union zet017_packet* packet) {
-	for (;;) {
-		if (zet017_device_get_info_cmd(device, packet) != 0)
-			break;
+ZET017_TCP_API zet017_device_set_tenso_config_async(struct zet017_server* server, uint32_t number,
+	const struct zet017_tenso_config* config, zet017_request_callback callback, void* context, struct zet017_request** request) {
+	uint32_t epoch = zet017_registry_enter(server);
+	int r = zet017_device_set_tenso_config_async_impl(server, number, config, callback, context, request);
+	zet017_registry_leave(server, epoch);
 
-		packet->info.start_adc = packet->info.start_dac = 0;
-		zet017_set_size_packet_adc(&packet->info);
+	return r;
+}
 
-		if (zet017_device_put_info_cmd(device, packet) != 0)
-			break;
+ZET017_TCP_API zet017_device_set_tenso_config(struct zet017_server* server, uint32_t number, const struct zet017_tenso_config* config) {
+	struct zet017_request* request = NULL;
+	uint32_t epoch = zet017_registry_enter(server);
+	int r = zet017_device_set_tenso_config_async_impl(server, number, config, NULL, NULL, &request);
+	zet017_registry_leave(server, epoch);
 
-		if (zet017_device_read_correction_cmd(device, packet) != 0)
-			break;
+	if (r != 0)
+		return r;
 
-		if (zet017_device_read_tenso_cmd(device, packet) != 0)
-			break;
+	return zet017_request_result(request);
+}
 
-		zet017_device_update_adc_dac_info(device);
+static int zet017_device_start_async_impl(struct zet017_server* server, uint32_t number, uint32_t dac,
+	zet017_request_callback callback, void* context, struct zet017_request** request) {
+	int r = 0;
+	struct zet017_device* device = zet017_get_connected_device(server, number, &r);
+	if (device == NULL)
+		return r;
 
-		device->timestamp = zet017_get_timestamp();
+	struct zet017_request* req = zet017_request_create(zet017_start, callback, context, request != NULL);
+	if (req == NULL)
+		return -3;
+	req->args.dac = dac;
 
-		return 0;
-	}
+	zet017_device_submit(device, req);
+	if (request != NULL)
+		*request = req;
 
-	zet017_device_close(device);
+	return 0;
+}
 
-	return -1;
+ZET017_TCP_API zet017_device_start_async(struct zet017_server* server, uint32_t number, uint32_t dac,
+	zet017_request_callback callback, void* context, struct zet017_request** request) {
+	uint32_t epoch = zet017_registry_enter(server);
+	int r = zet017_device_start_async_impl(server, number, dac, callback, context, request);
+	zet017_registry_leave(server, epoch);
+
+	return r;
 }
 
-static void zet017_process_adc_dac(struct zet017_device* device, union zet017_packet* packet) {
-	fd_set rfds;
-	FD_ZERO(&rfds);
-	FD_SET(device->wakeup_socket[1], &rfds);
-	FD_SET(device->adc_socket, &rfds);
-	FD_SET(device->dac_socket, &rfds);
+ZET017_TCP_API zet017_device_start(struct zet017_server* server, uint32_t number, uint32_t dac) {
+	struct zet017_request* request = NULL;
+	uint32_t epoch = zet017_registry_enter(server);
+	int r = zet017_device_start_async_impl(server, number, dac, NULL, NULL, &request);
+	zet017_registry_leave(server, epoch);
 
-	int nfds = (int)(device->adc_socket > device->wakeup_socket[1] ? device->adc_socket : device->wakeup_socket[1]);
-	if (nfds < (int)device->dac_socket)
-		nfds = (int)device->dac_socket;
+	if (r != 0)
+		return r;
 
-	int dac = 0;
-	fd_set wfds;
-	FD_ZERO(&wfds);
-	if (device->device_info.start_dac) {
-		uint64_t dac_count =
-			device->adc_dac_data.adc_count * device->adc_dac_data.sample_rate_dac / device->adc_dac_data.sample_rate_adc;
-		if (device->adc_dac_data.dac_count < dac_count + device->adc_dac_data.sample_rate_dac / 5)
-			dac = 1;
-	}
-	if (dac != 0)
-		FD_SET(device->dac_socket, &wfds);
+	return zet017_request_result(request);
+}
 
-	struct timeval tv;
-	tv.tv_sec = 10;
-	tv.tv_usec = 0;
+static int zet017_device_stop_async_impl(struct zet017_server* server, uint32_t number,
+	zet017_request_callback callback, void* context, struct zet017_request** request) {
+	int r = 0;
+	struct zet017_device* device = zet017_get_connected_device(server, number, &r);
+	if (device == NULL)
+		return r;
 
-	int r = select(nfds + 1, &rfds, dac ? &wfds : NULL, NULL, &tv);
-	if (r == -1) {
-		zet017_device_close(device);
-		return;
-	}
+	struct zet017_request* req = zet017_request_create(zet017_stop, callback, context, request != NULL);
+	if (req == NULL)
+		return -3;
+
+	zet017_device_submit(device, req);
+	if (request != NULL)
+		*request = req;
+
+	return 0;
+}
 
-	if (r > 0) {
-		if (FD_ISSET(device->adc_socket, &rfds)) {
-			r = recv(device->adc_socket, packet->raw, sizeof(*packet), 0);
-			if (r <= 0) {
-				zet017_device_close(device);
-				return;
-			}
-			if (r == sizeof(*packet)) {
-				mutex_lock(&device->adc_data.mutex);
-
-				uint32_t size = device->device_info.size_packet_adc * 2;
-				device->adc_dac_data.adc_count +=
-					size / device->adc_dac_data.work_channel_adc / device->adc_dac_data.sample_size_adc;
-
-				if (size <= ZET017_ADC_BUFFER_SIZE - device->adc_data.pointer) {
-					memcpy(device->adc_data.buffer + device->adc_data.pointer, packet->raw, size);
-					device->adc_data.pointer += size;
-					if (device->adc_data.pointer >= ZET017_ADC_BUFFER_SIZE)
-						device->adc_data.pointer -= ZET017_ADC_BUFFER_SIZE;
-				}
-				else {
-					size = ZET017_ADC_BUFFER_SIZE - device->adc_data.pointer;
-					memcpy(device->adc_data.buffer + device->adc_data.pointer, packet->raw, size);
-					uint32_t offset = size;
-					size = device->device_info.size_packet_adc * 2 - offset;
-					memcpy(device->adc_data.buffer, packet->raw + offset, size);
-					device->adc_data.pointer = size;
-				}
+ZET017_TCP_API zet017_device_stop_async(struct zet017_server* server, uint32_t number,
+	zet017_request_callback callback, void* context, struct zet017_request** request) {
+	uint32_t epoch = zet017_registry_enter(server);
+	int r = zet017_device_stop_async_impl(server, number, callback, context, request);
+	zet017_registry_leave(server, epoch);
 
-				mutex_unlock(&device->adc_data.mutex);
-			}
-		}
+	return r;
+}
 
-		if (FD_ISSET(device->dac_socket, &rfds)) {
-			r = recv(device->dac_socket, packet->raw, sizeof(*packet), 0);
-			if (r <= 0) {
-				zet017_device_close(device);
-				return;
-			}
-		}
+ZET017_TCP_API zet017_device_stop(struct zet017_server* server, uint32_t number) {
+	struct zet017_request* request = NULL;
+	uint32_t epoch = zet017_registry_enter(server);
+	int r = zet017_device_stop_async_impl(server, number, NULL, NULL, &request);
+	zet017_registry_leave(server, epoch);
 
-		if (dac != 0) {
-			if (FD_ISSET(device->dac_socket, &wfds)) {
-				uint32_t size = sizeof(*packet);
+	if (r != 0)
+		return r;
 
-				mutex_lock(&device->dac_data.mutex);
+	zet017_request_result(request);
 
-				if (size <= ZET017_DAC_BUFFER_SIZE - device->dac_data.pointer) {
-					memcpy(packet->raw, device->dac_data.buffer + device->dac_data.pointer, size);
-					memset(device->dac_data.buffer + device->dac_data.pointer, 0, size);
-					device->dac_data.pointer += size;
-					if (device->dac_data.pointer >= ZET017_DAC_BUFFER_SIZE)
-						device->dac_data.pointer -= ZET017_DAC_BUFFER_SIZE;
-				}
-				else {
-					size = ZET017_DAC_BUFFER_SIZE - device->dac_data.pointer;
-					memcpy(packet->raw, device->dac_data.buffer + device->dac_data.pointer, size);
-					memset(device->dac_data.buffer + device->dac_data.pointer, 0, size);
-					uint32_t offset = size;
-					size = sizeof(*packet) - offset;
-					memcpy(packet->raw + offset, device->dac_data.buffer, size);
-					device->dac_data.pointer = size;
-				}
+	return 0;
+}
 
-				mutex_unlock(&device->dac_data.mutex);
+ZET017_TCP_API zet017_request_poll(struct zet017_request* request, int* result) {
+	if (request == NULL)
+		return -1;
 
-				r = send(device->dac_socket, packet->raw, sizeof(*packet), 0);
-				if (r != sizeof(*packet)) {
-					zet017_device_close(device);
-					return;
-				}
-				device->adc_dac_data.dac_count += 
-					sizeof(*packet) / device->adc_dac_data.work_channel_dac / device->adc_dac_data.sample_size_dac;
-			}
-		}
+	mutex_lock(&request->mutex);
+	uint16_t completed = request->completed;
+	if (completed && result != NULL)
+		*result = request->result;
+	mutex_unlock(&request->mutex);
 
-		if (FD_ISSET(device->wakeup_socket[1], &rfds)) {
-			char buf;
-			if (recv(device->wakeup_socket[1], &buf, 1, 0) <= 0) {
-				zet017_device_close(device);
-				return;
+	return completed ? 0 : -2;
+}
+
+ZET017_TCP_API zet017_request_wait(struct zet017_request* request, uint32_t timeout_ms, int* result) {
+	if (request == NULL)
+		return -1;
+
+	// Spurious wakeups do not restart the timeout.
+	uint32_t start = zet017_get_timestamp();
+	mutex_lock(&request->mutex);
+	while (!request->completed) {
+		if (timeout_ms == ZET017_WAIT_INFINITE)
+			cond_wait(&request->cond, &request->mutex);
+		else {
+			uint32_t elapsed = zet017_get_timestamp() - start;
+			if (elapsed >= timeout_ms) {
+				mutex_unlock(&request->mutex);
+				return -2;
 			}
+			(void)cond_timedwait(&request->cond, &request->mutex, timeout_ms - elapsed);
 		}
 	}
+	if (result != NULL)
+		*result = request->result;
+	mutex_unlock(&request->mutex);
+
+	return 0;
 }
 
-static void zet017_update_state(struct zet017_device* device, union zet017_packet* packet) {
-	uint32_t timestamp = zet017_get_timestamp();
-	if (timestamp - device->timestamp > 60000) {
-		device->timestamp = timestamp;
-		if (zet017_device_get_info_cmd(device, packet) != 0)
-		{
-			zet017_device_close(device);
-			return;
+ZET017_TCP_API zet017_request_free(struct zet017_request** request) {
+	if (request == NULL || *request == NULL)
+		return -1;
+
+	zet017_request_release(*request);
+	*request = NULL;
+
+	return 0;
+}
+
+// Resolves the devices inside a reader section and counts itself as a waiter on each of them,
+// like zet017_device_wait_for_samples(), so a removal waits for the group instead of the registry.
+static int zet017_group_enter(struct zet017_server* server, const uint32_t* numbers, uint32_t count,
+	struct zet017_device** devices) {
+	uint32_t epoch = zet017_registry_enter(server);
+
+	// A device listed twice would queue its second request behind a first one that waits for it.
+	int r = 0;
+	for (uint32_t i = 0; i < count && r == 0; ++i) {
+		int e = 0;
+		devices[i] = zet017_get_connected_device(server, numbers[i], &e);
+		if (devices[i] == NULL)
+			r = -2;
+		for (uint32_t j = 0; j < i && r == 0; ++j) {
+			if (devices[j] == devices[i])
+				r = -1;
 		}
 	}
+	for (uint32_t i = 0; i < count && r == 0; ++i)
+		(void)zet017_notify_enter(devices[i]);
 
-	mutex_lock(&device->state_mutex);
+	zet017_registry_leave(server, epoch);
 
-	device->state.is_connected = device->is_connected;
-	device->state.reconnect = device->reconnect;
-	device->state.pointer_adc = device->adc_data.pointer / device->device_info.work_channel_adc;
-	if (device->device_info.type_data_adc == 0)
-		device->state.pointer_adc /= sizeof(int16_t);
-	if (device->device_info.type_data_adc == 1)
-		device->state.pointer_adc /= sizeof(int32_t);
-	if (device->device_info.work_channel_dac != 0)
-		device->state.pointer_dac = device->dac_data.pointer / device->device_info.work_channel_dac;
-	else
-		device->state.pointer_dac = 0;
-	if (device->device_info.type_data_dac == 0)
-		device->state.pointer_dac /= sizeof(int16_t);
-	if (device->device_info.type_data_dac == 1)
-		device->state.pointer_dac /= sizeof(int32_t);
+	return r;
+}
 
-	mutex_unlock(&device->state_mutex);
+static void zet017_group_leave(struct zet017_device** devices, uint32_t count) {
+	for (uint32_t i = 0; i < count; ++i)
+		zet017_notify_leave(devices[i]);
 }
 
-static void zet017_process_command(struct zet017_device* device) {
-	mutex_lock(&device->command.mutex);
+static int zet017_server_group_impl(enum zet017_command command,
+	struct zet017_device** devices, uint32_t count, uint32_t dac, int* results) {
+	struct zet017_request** requests = (struct zet017_request**)calloc(count, sizeof(struct zet017_request*));
+	if (requests == NULL)
+		return -3;
 
-	if (device->command.state == zet017_command_idle) {
-		mutex_unlock(&device->command.mutex);
-		return;
+	int r = 0;
+	for (uint32_t i = 0; i < count && r == 0; ++i) {
+		requests[i] = zet017_request_create(command, NULL, NULL, 1);
+		if (requests[i] == NULL)
+			r = -3;
 	}
-
-	device->command.state = zet017_command_processing;
-	device->command.result = -1;
-	if (zet017_device_process_wakeup(device) == 0) {
-		switch (device->command.command) {
-		case zet017_set_config:
-			device->command.result = zet017_device_put_info_cmd(device, &device->command.data);
-			zet017_device_update_adc_dac_info(device);
-			break;
-		case zet017_write_tenso_config:
-			device->command.result = zet017_device_write_tenso_cmd(device, &device->command.data);
-			break;
-		case zet017_start:
-			device->command.result = zet017_device_start_cmd(device, &device->command.data);
-			zet017_device_update_adc_dac_info(device);
-			break;
-		case zet017_stop:
-			device->command.result = zet017_device_stop_cmd(device, &device->command.data);
-			break;
-		default:
-			break;
+	if (r != 0) {
+		for (uint32_t i = 0; i < count; ++i) {
+			if (requests[i] != NULL)
+				zet017_request_free(&requests[i]);
 		}
+		free(requests);
+		return r;
 	}
-	device->command.state = zet017_command_completed;
-	if (device->command.result != 0)
-		zet017_device_close(device);
-
-	cond_signal(&device->command.cond);
-	mutex_unlock(&device->command.mutex);
-}
 
-static THREAD_RETURN zet017_device_thread_func(void* arg) {
-	struct zet017_device* device = (struct zet017_device*)arg;
-	union zet017_packet packet;
-#if !defined(ZET017_TCP_WINDOWS)
-	struct timespec ts = { 0, 100000000 };
-#endif
+	struct zet017_group group;
+	memset(&group, 0, sizeof(group));
+	group.count = count;
+	if (0 != mutex_init(&group.mutex))
+		r = -3;
+	else if (0 != cond_init(&group.cond)) {
+		mutex_destroy(&group.mutex);
+		r = -3;
+	}
+	if (r != 0) {
+		for (uint32_t i = 0; i < count; ++i)
+			zet017_request_free(&requests[i]);
+		free(requests);
+		return r;
+	}
 
-	while (device->running) {
-		if (device->is_connected)
-			zet017_process_adc_dac(device, &packet);
-		else {
-			if (zet017_device_connect(device) == 0) {
-				if (zet017_device_init(device, &packet) == 0) {
-					device->is_connected = 1;
-					++device->reconnect;
-				}
-			}
+	for (uint32_t i = 0; i < count; ++i) {
+		requests[i]->args.dac = dac;
+		requests[i]->group = &group;
+		zet017_device_submit(devices[i], requests[i]);
+	}
 
-			if (!device->is_connected) {
-#if defined(ZET017_TCP_WINDOWS)
-				Sleep(100);
-#else
-				nanosleep(&ts, NULL);
-#endif
-				continue;
-			}
-		}
+	mutex_lock(&group.mutex);
+	while (group.arrived != group.count)
+		cond_wait(&group.cond, &group.mutex);
+	group.released = 1;
+	mutex_unlock(&group.mutex);
+
+	for (uint32_t i = 0; i < count; ++i)
+		zet017_device_wakeup(devices[i]);
+
+	for (uint32_t i = 0; i < count; ++i) {
+		int result = 0;
+		zet017_request_wait(requests[i], ZET017_WAIT_INFINITE, &result);
+		zet017_request_free(&requests[i]);
+		if (results != NULL)
+			results[i] = result;
+		if (result != 0)
+			r = -4;
+	}
 
-		zet017_process_command(device);
+	mutex_destroy(&group.mutex);
+	cond_destroy(&group.cond);
+	free(requests);
 
-		zet017_update_state(device, &packet);
-	}
+	return r;
+}
 
-#if defined(ZET017_TCP_WINDOWS)
-	return 0;
-#else
-	return NULL;
-#endif
+static void zet017_device_get_start_times(struct zet017_device* device, struct zet017_start_info* info) {
+	info->start_time = atomic_load_u64(&device->adc_dac_data.start_time);
+	info->first_packet_time = atomic_load_u64(&device->adc_dac_data.first_packet_time);
 }
 
-ZET017_TCP_API zet017_server_create(struct zet017_server** server_ptr) {
-	if (!server_ptr)
+ZET017_TCP_API zet017_server_start_group(
+	struct zet017_server* server, const uint32_t* numbers, uint32_t count, uint32_t dac, struct zet017_start_info* info) {
+	if (server == NULL || numbers == NULL || count == 0)
 		return -1;
 
-	if (0 != network_init())
-		return -2;
-
-	struct zet017_server* server = malloc(sizeof(struct zet017_server));
-	if (!server) {
-		network_cleanup();
+	struct zet017_device** devices = (struct zet017_device**)calloc(count, sizeof(struct zet017_device*));
+	int* results = (int*)calloc(count, sizeof(int));
+	if (devices == NULL || results == NULL) {
+		free(devices);
+		free(results);
 		return -3;
 	}
 
-	memset(server, 0, sizeof(struct zet017_server));
-	server->devices = NULL;
-	server->device_count = 0;
-	if (0 != mutex_init(&server->devices_mutex)) {
-		free(server);
-		network_cleanup();
-		return -4;
+	mutex_lock(&server->group_mutex);
+	int r = zet017_group_enter(server, numbers, count, devices);
+	if (r == 0) {
+		r = zet017_server_group_impl(zet017_start, devices, count, dac, results);
+		if (info != NULL && (r == 0 || r == -4)) {
+			for (uint32_t i = 0; i < count; ++i) {
+				info[i].result = results[i];
+				zet017_device_get_start_times(devices[i], &info[i]);
+			}
+		}
+		zet017_group_leave(devices, count);
 	}
+	mutex_unlock(&server->group_mutex);
+	free(devices);
+	free(results);
 
-	*server_ptr = server;
-
-	return 0;
+	return r;
 }
 
-ZET017_TCP_API zet017_server_free(struct zet017_server** server_ptr) {
-	if (!server_ptr)
+ZET017_TCP_API zet017_server_stop_group(struct zet017_server* server, const uint32_t* numbers, uint32_t count, int* results) {
+	if (server == NULL || numbers == NULL || count == 0)
 		return -1;
 
-	struct zet017_server* server = *server_ptr;
-
-	if (!server)
-		return -2;
+	struct zet017_device** devices = (struct zet017_device**)calloc(count, sizeof(struct zet017_device*));
+	if (devices == NULL)
+		return -3;
 
-	mutex_lock(&server->devices_mutex);
-	struct zet017_device* current = server->devices;
-	while (current != NULL) {
-		struct zet017_device* next = current->next;
-		zet017_device_destroy(current);
-		current = next;
+	mutex_lock(&server->group_mutex);
+	int r = zet017_group_enter(server, numbers, count, devices);
+	if (r == 0) {
+		r = zet017_server_group_impl(zet017_stop, devices, count, 0, results);
+		zet017_group_leave(devices, count);
 	}
-	server->devices = NULL;
-	server->device_count = 0;
-	mutex_unlock(&server->devices_mutex);
-	mutex_destroy(&server->devices_mutex);
-
-	free(server);
-	*server_ptr = NULL;
-
-	network_cleanup();
+	mutex_unlock(&server->group_mutex);
+	free(devices);
 
-	return 0;
+	return r;
 }
 
-ZET017_TCP_API zet017_server_add_device(struct zet017_server* server, const char* ip) {
-	if (!server)
+static int zet017_device_get_start_info_impl(struct zet017_server* server, uint32_t number, struct zet017_start_info* info) {
+	if (!info)
 		return -1;
 
-	if (!ip)
+	struct zet017_device* device = zet017_get_device(server, number);
+	if (device == NULL)
 		return -2;
 
-	mutex_lock(&server->devices_mutex);
+	info->result = 0;
+	zet017_device_get_start_times(device, info);
 
-	struct zet017_device* existing = server->devices;
-	while (existing != NULL) {
-		if (strcmp(existing->ip, ip) == 0) {
-			mutex_unlock(&server->devices_mutex);
-			return -3;
-		}
-		existing = existing->next;
-	}
+	return 0;
+}
 
-	struct zet017_device* device = malloc(sizeof(struct zet017_device));
-	if (!device) {
-		mutex_unlock(&server->devices_mutex);
-		return -4;
-	}
+ZET017_TCP_API zet017_device_get_start_info(struct zet017_server* server, uint32_t number, struct zet017_start_info* info) {
+	uint32_t epoch = zet017_registry_enter(server);
+	int r = zet017_device_get_start_info_impl(server, number, info);
+	zet017_registry_leave(server, epoch);
 
-	for (;;) {
-		memset(device, 0, sizeof(struct zet017_device));
-		strncpy(device->ip, ip, MAX_IP_LENGTH - 1);
-		device->ip[MAX_IP_LENGTH - 1] = '\0';
-		strncpy(device->info.ip, ip, MAX_IP_LENGTH - 1);
-		device->info.ip[MAX_IP_LENGTH - 1] = '\0';
-		device->cmd_socket = device->adc_socket = device->dac_socket = INVALID_SOCKET;
-		device->wakeup_socket[0] = device->wakeup_socket[1] = INVALID_SOCKET;
-		device->is_connected = 0;
-		if (0 != mutex_init(&device->state_mutex))
-			break;
-		if (0 != mutex_init(&device->info_mutex))
-			break;
-		if (0 != mutex_init(&device->config_mutex))
-			break;
-		if (0 != mutex_init(&device->command.mutex))
-			break;
-		if (0 != mutex_init(&device->adc_data.mutex))
-			break;
-		if (0 != mutex_init(&device->dac_data.mutex))
-			break;
-		if (0 != cond_init(&device->command.cond))
-			break;
-		device->command.state = zet017_command_idle;
+	return r;
+}
 
-		device->running = 1;
-#if defined(ZET017_TCP_WINDOWS)
-		device->work_thread = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE)zet017_device_thread_func, device, 0, NULL);
-		if (device->work_thread == NULL)
-#else
-		if (0 != pthread_create(&device->work_thread, NULL, zet017_device_thread_func, device))
-#endif
-			break;
-		if (server->devices == NULL)
-			server->devices = device;
-		else {
-			for (struct zet017_device* d = server->devices; d != NULL; d = d->next) {
-				if (d->next == NULL) {
-					d->next = device;
-					break;
-				}
-			}
-		}
-		++server->device_count;
+// The ring is not cleared on start. The stream starts at a multiple of the ring size, so during its
+// first lap frames [0, limit) hold current data and the rest, still stale, reads back as zeros.
+static uint32_t zet017_adc_valid_frames(const struct zet017_adc_ring* ring, uint64_t sequence,
+	uint32_t step, uint32_t channel_size) {
+	uint64_t written = sequence - ring->sequence_start;
+	if (written >= ring->size)
+		return channel_size;
 
-		mutex_unlock(&server->devices_mutex);
+	return (uint32_t)written / step;
+}
 
-		return 0;
-	}
+// The receive does not wait for readers. The size frames from ring frame p were read while sequence
+// was the end of the data; if the receive claimed the oldest of them meanwhile, the copy may be torn.
+// A window reaching past the end of the data starts with the oldest frame in the ring.
+static int zet017_adc_window_torn(struct zet017_device* device, const struct zet017_adc_ring* ring,
+	uint64_t sequence, uint32_t step, uint32_t p, uint32_t size) {
+	uint32_t channel_size = ring->size / step;
+	uint64_t end = (sequence - ring->sequence_start) / step;
+	uint32_t head = (uint32_t)(end % channel_size);
+	uint32_t distance = head >= p ? head - p : head + channel_size - p;
+
+	uint64_t oldest = end >= channel_size ? end - channel_size : 0;
+	if (distance >= size && distance <= end)
+		oldest = end - distance;
+
+	memory_fence();
+	uint64_t pending = atomic_load_u64(&device->adc_data.sequence_pending);
+	return pending > ring->sequence_start + oldest * step + ring->size;
+}
 
-	zet017_device_destroy(device);
+static int zet017_channel_get_data_impl(
+	struct zet017_server* server, uint32_t number, uint32_t channel, uint32_t pointer, float* data, uint32_t size) {
+	struct zet017_device* device = zet017_get_device(server, number);
+	if (device == NULL)
+		return -1;
 
-	mutex_unlock(&server->devices_mutex);
+	//if (channel >= ZET017_MAX_CHANNELS_ADC)
+	//	return -2;
 
-	return -5;
-}
+	mutex_lock(&device->state_mutex);
+	uint16_t is_connected = device->state.is_connected;
+	mutex_unlock(&device->state_mutex);
+	if (!is_connected)
+		return -3;
 
-ZET017_TCP_API zet017_server_remove_device(struct zet017_server* server, const char* ip) {
-	if (!server)
-		return -1;
+	if (data == NULL)
+		return -4;
 
-	if (!ip)
-		return -2;
+	struct zet017_adc_ring ring;
+	zet017_adc_ring_read(&device->adc_data, &ring);
 
-	mutex_lock(&server->devices_mutex);
+	if (channel >= ring.channel_quantity)
+		return -2;
 
-	struct zet017_device* current = server->devices;
-	struct zet017_device* prev = NULL;
-	while (current != NULL) {
-		if (strcmp(current->ip, ip) == 0) {
-			if (prev == NULL)
-				server->devices = current->next;
-			else
-				prev->next = current->next;
+	if (!(ring.channel_mask & (1 << channel)))
+		return -5;
 
-			zet017_device_destroy(current);
-			--server->device_count;
+	uint32_t step = ring.sample_size * ring.work_channel;
+	uint32_t channel_size = ring.size / step;
+	if (pointer >= channel_size || size > channel_size)
+		return -6;
 
-			mutex_unlock(&server->devices_mutex);
-			
-			return 0;
-		}
+	uint32_t offset = 0;
+	for (uint32_t i = 0; i < channel; ++i) {
+		if (ring.channel_mask & (1 << i))
+			offset += ring.sample_size;
+	}
 
-		prev = current;
-		current = current->next;
+	zet017_convert_func convert =
+		ring.sample_size == sizeof(int16_t) ? zet017_convert.int16 : zet017_convert.int32;
+	float resolution = ring.resolution[channel][ring.amplify_code[channel]];
+
+	uint64_t sequence = atomic_load_u64(&device->adc_data.sequence);
+	uint32_t limit = zet017_adc_valid_frames(&ring, sequence, step, channel_size);
+
+	uint32_t first = pointer;
+	if (first >= size)
+		first -= size;
+	else
+		first = first + channel_size - size;
+	uint32_t p = first;
+	for (uint32_t i = 0; i < size;) {
+		uint32_t count = channel_size - p;
+		if (count > size - i)
+			count = size - i;
+
+		uint32_t valid = p < limit ? limit - p : 0;
+		if (valid > count)
+			valid = count;
+		convert(ring.buffer + p * step + offset, step, resolution, data + i, valid);
+		memset(data + i + valid, 0, (count - valid) * sizeof(float));
+
+		i += count;
+		p = 0;
 	}
 
-	mutex_unlock(&server->devices_mutex);
+	if (zet017_adc_window_torn(device, &ring, sequence, step, first, size))
+		return -6;
 
-	return -1;
+	return 0;
 }
 
-ZET017_TCP_API zet017_device_get_info(struct zet017_server* server, uint32_t number, struct zet017_info* info) {
-	if (!info)
-		return -1;
+ZET017_TCP_API zet017_channel_get_data(
+	struct zet017_server* server, uint32_t number, uint32_t channel, uint32_t pointer, float* data, uint32_t size) {
+	uint32_t epoch = zet017_registry_enter(server);
+	int r = zet017_channel_get_data_impl(server, number, channel, pointer, data, size);
+	zet017_registry_leave(server, epoch);
 
-	struct zet017_device* device = zet017_get_device(server, number);
-	if (device == NULL)
+	return r;
+}
+
+// Where each requested channel sits in a frame, its scale and its destination; filled from a copy of the ring layout.
+struct zet017_frames_layout {
+	const uint8_t* buffer;
+	uint32_t offset[ZET017_MAX_CHANNELS_ADC + 1];
+	float resolution[ZET017_MAX_CHANNELS_ADC + 1];
+	float* dst[ZET017_MAX_CHANNELS_ADC + 1];
+	uint32_t channels;
+	uint32_t step;
+	uint32_t channel_size;
+	zet017_convert_func convert;
+	zet017_deinterleave_func deinterleave;
+};
+
+static int zet017_frames_layout_init(const struct zet017_adc_ring* ring, float** data, uint32_t count, struct zet017_frames_layout* layout) {
+	if (count > ring->channel_quantity)
 		return -2;
 
-	mutex_lock(&device->info_mutex);
-	memcpy(info, &device->info, sizeof(struct zet017_info));
-	mutex_unlock(&device->info_mutex);
+	layout->channels = 0;
+	uint32_t sample_offset = 0;
+	for (uint32_t i = 0; i < ring->channel_quantity; ++i) {
+		if (!(ring->channel_mask & (1 << i)))
+			continue;
+
+		if (i < count && data[i] != NULL) {
+			layout->offset[layout->channels] = sample_offset;
+			layout->resolution[layout->channels] = ring->resolution[i][ring->amplify_code[i]];
+			layout->dst[layout->channels] = data[i];
+			++layout->channels;
+		}
+		sample_offset += ring->sample_size;
+	}
+	for (uint32_t i = 0; i < count; ++i) {
+		if (data[i] != NULL && !(ring->channel_mask & (1 << i)))
+			return -5;
+	}
+
+	layout->buffer = ring->buffer;
+	layout->step = ring->sample_size * ring->work_channel;
+	layout->channel_size = layout->step != 0 ? ring->size / layout->step : 0;
+	layout->convert = ring->sample_size == sizeof(int16_t) ? zet017_convert.int16 : zet017_convert.int32;
+	layout->deinterleave = NULL;
+	if (layout->channels == ZET017_DEINTERLEAVE_CHANNELS && ring->work_channel == ZET017_DEINTERLEAVE_CHANNELS)
+		layout->deinterleave = ring->sample_size == sizeof(int16_t) ? zet017_convert.deinterleave_int16 : zet017_convert.deinterleave_int32;
 
 	return 0;
 }
 
-ZET017_TCP_API zet017_device_get_state(struct zet017_server* server, uint32_t number, struct zet017_state* state) {
-	if (!state)
-		return -1;
+// Converts `size` frames starting at ring frame `p`; frames from `limit` on read back as zeros.
+static void zet017_frames_convert(const struct zet017_frames_layout* layout, uint32_t p, uint32_t size, uint32_t limit) {
+	// Ring size is a multiple of the frame size, so frames never straddle the wrap point.
+	// Frames are converted in blocks small enough to stay in cache while every channel is extracted.
+	for (uint32_t i = 0; i < size;) {
+		uint32_t block = layout->channel_size - p;
+		if (block > size - i)
+			block = size - i;
+		if (block > ZET017_FRAMES_BLOCK_SIZE)
+			block = ZET017_FRAMES_BLOCK_SIZE;
+
+		uint32_t valid = p < limit ? limit - p : 0;
+		if (valid > block)
+			valid = block;
+		const uint8_t* frames = layout->buffer + p * layout->step;
+		if (layout->deinterleave != NULL) {
+			float* dst[ZET017_DEINTERLEAVE_CHANNELS];
+			for (uint32_t j = 0; j < ZET017_DEINTERLEAVE_CHANNELS; ++j)
+				dst[j] = layout->dst[j] + i;
+			layout->deinterleave(frames, layout->resolution, dst, valid);
+		}
+		else {
+			for (uint32_t j = 0; j < layout->channels; ++j)
+				layout->convert(frames + layout->offset[j], layout->step, layout->resolution[j], layout->dst[j] + i, valid);
+		}
+		for (uint32_t j = 0; j < layout->channels; ++j)
+			memset(layout->dst[j] + i + valid, 0, (block - valid) * sizeof(float));
 
+		i += block;
+		p += block;
+		if (p >= layout->channel_size)
+			p -= layout->channel_size;
+	}
+}
+
+static int zet017_device_get_frames_impl(
+	struct zet017_server* server, uint32_t number, uint32_t pointer, float** data, uint32_t count, uint32_t size) {
 	struct zet017_device* device = zet017_get_device(server, number);
 	if (device == NULL)
-		return -2;
+		return -1;
 
 	mutex_lock(&device->state_mutex);
+	uint16_t is_connected = device->state.is_connected;
+	mutex_unlock(&device->state_mutex);
+	if (!is_connected)
+		return -3;
 
-	memcpy(state, &device->state, sizeof(struct zet017_state));
+	if (data == NULL)
+		return -4;
 
-	mutex_unlock(&device->state_mutex);
+	struct zet017_adc_ring ring;
+	zet017_adc_ring_read(&device->adc_data, &ring);
 
-	return 0;
-}
+	struct zet017_frames_layout layout;
+	int r = zet017_frames_layout_init(&ring, data, count, &layout);
+	if (r != 0)
+		return r;
 
-ZET017_TCP_API zet017_device_get_config(struct zet017_server* server, uint32_t number, struct zet017_config* config) {
-	if (!config)
-		return -1;
+	uint32_t channel_size = layout.channel_size;
+	if (pointer >= channel_size || size > channel_size)
+		return -6;
 
-	struct zet017_device* device = zet017_get_device(server, number);
-	if (device == NULL)
-		return -2;
+	uint64_t sequence = atomic_load_u64(&device->adc_data.sequence);
+	uint32_t limit = zet017_adc_valid_frames(&ring, sequence, layout.step, channel_size);
 
-	mutex_lock(&device->config_mutex);
-	memcpy(config, &device->config, sizeof(struct zet017_config));
-	mutex_unlock(&device->config_mutex);
+	uint32_t p = pointer;
+	if (p >= size)
+		p -= size;
+	else
+		p = p + channel_size - size;
+
+	zet017_frames_convert(&layout, p, size, limit);
+
+	if (zet017_adc_window_torn(device, &ring, sequence, layout.step, p, size))
+		return -6;
 
 	return 0;
 }
 
-ZET017_TCP_API zet017_device_get_tenso_config(struct zet017_server* server, uint32_t number, struct zet017_tenso_config* config) {
-	if (!config)
-		return -1;
+ZET017_TCP_API zet017_device_get_frames(
+	struct zet017_server* server, uint32_t number, uint32_t pointer, float** data, uint32_t count, uint32_t size) {
+	uint32_t epoch = zet017_registry_enter(server);
+	int r = zet017_device_get_frames_impl(server, number, pointer, data, count, size);
+	zet017_registry_leave(server, epoch);
+
+	return r;
+}
+
+// Frames of the current stream still held by the ring, [first, end), counted from the start.
+// The oldest frames may already be claimed by a receive in progress, they are not counted.
+static void zet017_adc_frame_range(struct zet017_device* device, const struct zet017_adc_ring* ring,
+	uint32_t step, uint64_t* first, uint64_t* end) {
+	uint64_t start = ring->sequence_start;
+	uint64_t sequence = atomic_load_u64(&device->adc_data.sequence);
+	uint64_t pending = atomic_load_u64(&device->adc_data.sequence_pending);
+	uint64_t oldest = pending > ring->size ? pending - ring->size : 0;
+	if (oldest < start)
+		oldest = start;
+
+	*first = (oldest - start + step - 1) / step;
+	*end = (sequence - start) / step;
+}
 
+static int zet017_device_get_adc_position_impl(struct zet017_server* server, uint32_t number, uint64_t* first, uint64_t* end) {
 	struct zet017_device* device = zet017_get_device(server, number);
 	if (device == NULL)
-		return -2;
+		return -1;
 
-	mutex_lock(&device->config_mutex);
-	memcpy(config, &device->tenso_config, sizeof(struct zet017_tenso_config));
-	mutex_unlock(&device->config_mutex);
+	if (first == NULL && end == NULL)
+		return -4;
+
+	struct zet017_adc_ring ring;
+	zet017_adc_ring_read(&device->adc_data, &ring);
+
+	uint64_t oldest = 0, newest = 0;
+	uint32_t step = ring.sample_size * ring.work_channel;
+	if (step != 0 && ring.size != 0)
+		zet017_adc_frame_range(device, &ring, step, &oldest, &newest);
+
+	if (first != NULL)
+		*first = oldest;
+	if (end != NULL)
+		*end = newest;
 
 	return 0;
 }
 
-ZET017_TCP_API zet017_device_set_config(
-	struct zet017_server* server, uint32_t number, const struct zet017_config* config) {
+ZET017_TCP_API zet017_device_get_adc_position(struct zet017_server* server, uint32_t number, uint64_t* first, uint64_t* end) {
+	uint32_t epoch = zet017_registry_enter(server);
+	int r = zet017_device_get_adc_position_impl(server, number, first, end);
+	zet017_registry_leave(server, epoch);
+
+	return r;
+}
+
+static int zet017_device_read_frames_impl(
+	struct zet017_server* server, uint32_t number, uint64_t frame, float** data, uint32_t count, uint32_t size) {
 	struct zet017_device* device = zet017_get_device(server, number);
 	if (device == NULL)
 		return -1;
@@ -1722,190 +5911,245 @@ ZET017_TCP_API zet017_device_set_config(
 	uint16_t is_connected = device->state.is_connected;
 	mutex_unlock(&device->state_mutex);
 	if (!is_connected)
-		return -2;
-
-	if (!config)
 		return -3;
 
-	mutex_lock(&device->command.mutex);
+	if (data == NULL)
+		return -4;
 
-	memcpy(&device->command.data.info, &device->device_info, sizeof(struct zet017_device_info));
-	if (config->sample_rate_adc)
-		device->command.data.info.mode_adc = zet017_get_mode_adc(config->sample_rate_adc);
-	else
-		device->command.data.info.mode_adc = config->moda_adc;
-	if (config->sample_rate_dac)
-		device->command.data.info.rate_dac = zet017_get_rate_dac(config->sample_rate_dac);
-	else
-		device->command.data.info.rate_dac = config->rate_dac;
-	device->command.data.info.mask_channel_adc = config->mask_channel_adc;
-	device->command.data.info.mask_icp = config->mask_icp;
-	for (uint32_t i = 0; i < 8; ++i) {
-		if (config->gain[i])
-			device->command.data.info.amplify_code[i] = zet017_get_amplify_code(config->gain[i]);
-		else
-			device->command.data.info.amplify_code[i] = config->gain_code[i];
-	}
-	if (device->command.data.info.quantity_channel_adc == 4) {
-		device->command.data.info.mask_channel_adc = 
-			((config->mask_channel_adc & 0x1) << 1) +
-			((config->mask_channel_adc & 0x2) << 2) +
-			((config->mask_channel_adc & 0x4) << 3) +
-			((config->mask_channel_adc & 0x8) << 4);
-		device->command.data.info.mask_icp =
-			((config->mask_icp & 0x1) << 1) +
-			((config->mask_icp & 0x2) << 2) +
-			((config->mask_icp & 0x4) << 3) +
-			((config->mask_icp & 0x8) << 4);
-		for (uint32_t i = 0; i < 8; ++i) {
-			if (config->gain[i / 2])
-				device->command.data.info.amplify_code[i] = zet017_get_amplify_code(config->gain[i / 2]);
-			else
-				device->command.data.info.amplify_code[i] = config->gain_code[i / 2];
+	struct zet017_adc_ring ring;
+	zet017_adc_ring_read(&device->adc_data, &ring);
+
+	struct zet017_frames_layout layout;
+	int r = zet017_frames_layout_init(&ring, data, count, &layout);
+	if (r == 0 && layout.channel_size == 0)
+		r = -7;
+	if (r != 0)
+		return r;
+
+	uint64_t first, end;
+	zet017_adc_frame_range(device, &ring, layout.step, &first, &end);
+	if (size > layout.channel_size)
+		return -8;
+	if (frame < first)
+		return -6;
+	if (frame + size > end)
+		return -7;
+
+	zet017_frames_convert(&layout, (uint32_t)(frame % layout.channel_size), size, layout.channel_size);
+
+	// The receive does not wait for readers: if it claimed the range meanwhile, the copy may be torn.
+	memory_fence();
+	uint64_t pending = atomic_load_u64(&device->adc_data.sequence_pending);
+	if (pending > ring.sequence_start + frame * layout.step + ring.size)
+		return -6;
+
+	return 0;
+}
+
+ZET017_TCP_API zet017_device_read_frames(
+	struct zet017_server* server, uint32_t number, uint64_t frame, float** data, uint32_t count, uint32_t size) {
+	uint32_t epoch = zet017_registry_enter(server);
+	int r = zet017_device_read_frames_impl(server, number, frame, data, count, size);
+	zet017_registry_leave(server, epoch);
+
+	return r;
+}
+
+static int zet017_notify_wait(struct zet017_device* device, uint32_t pointer, uint32_t frames, uint32_t timeout_ms) {
+	struct zet017_notify_data* notify = &device->notify;
+	uint32_t start = zet017_get_timestamp();
+
+	int r;
+	mutex_lock(&notify->mutex);
+	for (;;) {
+		if (notify->closed) {
+			r = -1;
+			break;
+		}
+
+		mutex_lock(&device->state_mutex);
+		uint16_t is_connected = device->state.is_connected;
+		uint32_t pointer_adc = device->state.pointer_adc;
+		uint32_t buffer_size = device->state.buffer_size_adc;
+		mutex_unlock(&device->state_mutex);
+
+		if (!is_connected) {
+			r = -3;
+			break;
+		}
+
+		if (pointer >= buffer_size || frames >= buffer_size) {
+			r = -2;
+			break;
+		}
+
+		uint32_t available = pointer_adc >= pointer ? pointer_adc - pointer : buffer_size + pointer_adc - pointer;
+		if (available >= frames) {
+			r = 0;
+			break;
+		}
+
+		if (timeout_ms == ZET017_WAIT_INFINITE)
+			cond_wait(&notify->cond, &notify->mutex);
+		else {
+			uint32_t elapsed = zet017_get_timestamp() - start;
+			if (elapsed >= timeout_ms) {
+				r = -4;
+				break;
+			}
+			(void)cond_timedwait(&notify->cond, &notify->mutex, timeout_ms - elapsed);
 		}
 	}
-	device->command.data.info.builtin_dac_state = config->builtin_dac_state;
-	device->command.data.info.builtin_dac_sine_freq = (int32_t)config->builtin_dac_sine_freq;
-	double resolution_dac = device->command.data.info.resolution_dac[0];
-	if (!resolution_dac)
-		resolution_dac = device->command.data.info.resolution_dac_def;
-	device->command.data.info.builtin_dac_sine_ampl = (int32_t)(config->builtin_dac_sine_ampl / resolution_dac);
-	device->command.data.info.builtin_dac_sine_offset = (int32_t)(config->builtin_dac_sine_offset / resolution_dac);
-	zet017_set_size_packet_adc(&device->command.data.info);
-
-	device->command.command = zet017_set_config;
-	device->command.result = 0;
-	device->command.state = zet017_command_requested;
-	zet017_device_wakeup(device);
+	mutex_unlock(&notify->mutex);
 
-	while (device->command.state != zet017_command_completed)
-		cond_wait(&device->command.cond, &device->command.mutex);
+	return r;
+}
 
-	device->command.state = zet017_command_idle;
-	int r = device->command.result;
+// The wait holds a waiter count on the device instead of the registry, so it never delays adding
+// or removing devices; removing this one ends the wait with -1.
+ZET017_TCP_API zet017_device_wait_for_samples(
+	struct zet017_server* server, uint32_t number, uint32_t pointer, uint32_t frames, uint32_t timeout_ms) {
+	uint32_t epoch = zet017_registry_enter(server);
+	struct zet017_device* device = zet017_get_device(server, number);
+	int r = zet017_notify_enter(device);
+	zet017_registry_leave(server, epoch);
+	if (r != 0)
+		return r;
 
-	mutex_unlock(&device->command.mutex);
+	r = zet017_notify_wait(device, pointer, frames, timeout_ms);
+	zet017_notify_leave(device);
 
 	return r;
 }
 
-ZET017_TCP_API zet017_device_set_tenso_config(struct zet017_server* server, uint32_t number, const struct zet017_tenso_config* config)
-{
+static int zet017_device_set_notify_impl(struct zet017_server* server, uint32_t number, uint32_t watermark, intptr_t* fd) {
 	struct zet017_device* device = zet017_get_device(server, number);
 	if (device == NULL)
 		return -1;
 
-	mutex_lock(&device->state_mutex);
-	uint16_t is_connected = device->state.is_connected;
-	mutex_unlock(&device->state_mutex);
-	if (!is_connected)
+	if (fd == NULL)
 		return -2;
 
-	if (!config)
-		return -3;
-
-	mutex_lock(&device->command.mutex);
-
-	memcpy(device->command.data.cmd.data.u8, &device->tenso_info, sizeof(struct zet017_tenso_info));
-	struct zet017_tenso_info* tenso_info = (struct zet017_tenso_info*)(&device->command.data.cmd.data);
-	for (uint32_t i = 0; i < 8; ++i) {
-		tenso_info->scheme[i] = (uint16_t)config->scheme[i];
-		tenso_info->correction[i][0] = config->correction_1[i];
-		tenso_info->correction[i][1] = config->correction_2[i];
+	struct zet017_notify_data* notify = &device->notify;
+	int r = 0;
+	mutex_lock(&notify->mutex);
+	if (notify->signal[0] == INVALID_SOCKET && zet017_signal_open(notify->signal) != 0)
+		r = -3;
+	else {
+		// The descriptor is complete before the worker can see a watermark.
+		atomic_store_u32(&notify->watermark, watermark);
+		*fd = (intptr_t)notify->signal[1];
 	}
+	mutex_unlock(&notify->mutex);
 
-	device->command.command = zet017_write_tenso_config;
-	device->command.result = 0;
-	device->command.state = zet017_command_requested;
-	zet017_device_wakeup(device);
-
-	while (device->command.state != zet017_command_completed)
-		cond_wait(&device->command.cond, &device->command.mutex);
-
-	device->command.state = zet017_command_idle;
-	int r = device->command.result;
+	return r;
+}
 
-	mutex_unlock(&device->command.mutex);
+ZET017_TCP_API zet017_device_set_notify(struct zet017_server* server, uint32_t number, uint32_t watermark, intptr_t* fd) {
+	uint32_t epoch = zet017_registry_enter(server);
+	int r = zet017_device_set_notify_impl(server, number, watermark, fd);
+	zet017_registry_leave(server, epoch);
 
 	return r;
 }
 
-ZET017_TCP_API zet017_device_start(struct zet017_server* server, uint32_t number, uint32_t dac) {
+static int zet017_device_adc_view_impl(
+	struct zet017_server* server, uint32_t number, uint64_t sequence, struct zet017_adc_view* view) {
 	struct zet017_device* device = zet017_get_device(server, number);
 	if (device == NULL)
 		return -1;
 
-	mutex_lock(&device->state_mutex);
-	uint16_t is_connected = device->state.is_connected;
-	mutex_unlock(&device->state_mutex);
-	if (!is_connected)
-		return -2;
+	if (view == NULL)
+		return -4;
 
-	mutex_lock(&device->command.mutex);
+	memset(view, 0x0, sizeof(struct zet017_adc_view));
 
-	if (device->device_info.start_adc) {
-		mutex_unlock(&device->command.mutex);
-		return 0;
+	struct zet017_adc_ring ring;
+	zet017_adc_ring_read(&device->adc_data, &ring);
+	view->sample_size = ring.sample_size;
+	view->work_channel = ring.work_channel;
+	view->channel_mask = ring.channel_mask;
+	uint64_t start = ring.sequence_start;
+
+	uint64_t end = atomic_load_u64(&device->adc_data.sequence);
+
+	// No ring before the first start, so nothing has been received yet.
+	if (ring.size == 0) {
+		view->sequence = end;
+		return -7;
 	}
-	memcpy(&device->command.data.info, &device->device_info, sizeof(struct zet017_device_info));
-	device->command.data.info.start_adc = 1;
-	device->command.data.info.start_dac = (int16_t)dac;
-	memset(&device->command.data.info.atten, 0xff, sizeof(device->command.data.info.atten));
-	device->command.data.info.atten_speed = 0;
 
-	device->command.command = zet017_start;
-	device->command.result = 0;
-	device->command.state = zet017_command_requested;
-	zet017_device_wakeup(device);
+	uint64_t pending = atomic_load_u64(&device->adc_data.sequence_pending);
+	uint64_t oldest = pending > ring.size ? pending - ring.size : 0;
+	if (oldest < start)
+		oldest = start;
+
+	if (sequence < oldest) {
+		view->sequence = oldest;
+		return -6;
+	}
 
-	while (device->command.state != zet017_command_completed)
-		cond_wait(&device->command.cond, &device->command.mutex);
+	if (sequence > end) {
+		view->sequence = end;
+		return -7;
+	}
 
-	device->command.state = zet017_command_idle;
-	int r = device->command.result;
+	view->sequence = sequence;
+	uint32_t offset = (uint32_t)(sequence % ring.size);
+	uint32_t size = (uint32_t)(end - sequence);
+	view->span[0].data = ring.buffer + offset;
+	view->span[0].size = size;
+	if (size > ring.size - offset) {
+		view->span[0].size = ring.size - offset;
+		view->span[1].data = ring.buffer;
+		view->span[1].size = size - view->span[0].size;
+	}
 
-	mutex_unlock(&device->command.mutex);
+	return 0;
+}
+
+ZET017_TCP_API zet017_device_adc_view(
+	struct zet017_server* server, uint32_t number, uint64_t sequence, struct zet017_adc_view* view) {
+	uint32_t epoch = zet017_registry_enter(server);
+	int r = zet017_device_adc_view_impl(server, number, sequence, view);
+	zet017_registry_leave(server, epoch);
 
 	return r;
 }
 
-ZET017_TCP_API zet017_device_stop(struct zet017_server* server, uint32_t number) {
+static int zet017_device_adc_check_impl(struct zet017_server* server, uint32_t number, const struct zet017_adc_view* view) {
 	struct zet017_device* device = zet017_get_device(server, number);
 	if (device == NULL)
 		return -1;
 
-	mutex_lock(&device->state_mutex);
-	uint16_t is_connected = device->state.is_connected;
-	mutex_unlock(&device->state_mutex);
-	if (!is_connected)
-		return -2;
-
-	mutex_lock(&device->command.mutex);
-
-	device->command.command = zet017_stop;
-	device->command.result = 0;
-	device->command.state = zet017_command_requested;
-	zet017_device_wakeup(device);
+	if (view == NULL)
+		return -4;
 
-	while (device->command.state != zet017_command_completed)
-		cond_wait(&device->command.cond, &device->command.mutex);
+	// Everything the caller read from the view must be done before the producer position is sampled.
+	memory_fence();
+	uint64_t pending = atomic_load_u64(&device->adc_data.sequence_pending);
+	if (pending > view->sequence + atomic_load_u32(&device->adc_data.ring.size))
+		return -6;
 
-	device->command.state = zet017_command_idle;
-	int r = device->command.result;
+	return 0;
+}
 
-	mutex_unlock(&device->command.mutex);
+ZET017_TCP_API zet017_device_adc_check(struct zet017_server* server, uint32_t number, const struct zet017_adc_view* view) {
+	uint32_t epoch = zet017_registry_enter(server);
+	int r = zet017_device_adc_check_impl(server, number, view);
+	zet017_registry_leave(server, epoch);
 
-	return 0;
+	return r;
 }
 
-ZET017_TCP_API zet017_channel_get_data(
+static int zet017_channel_put_data_impl(
 	struct zet017_server* server, uint32_t number, uint32_t channel, uint32_t pointer, float* data, uint32_t size) {
 	struct zet017_device* device = zet017_get_device(server, number);
 	if (device == NULL)
 		return -1;
 
-	//if (channel >= ZET017_MAX_CHANNELS_ADC)
-	//	return -2;
+	if (channel >= ZET017_MAX_CHANNELS_DAC)
+		return -2;
 
 	mutex_lock(&device->state_mutex);
 	uint16_t is_connected = device->state.is_connected;
@@ -1916,59 +6160,73 @@ ZET017_TCP_API zet017_channel_get_data(
 	if (data == NULL)
 		return -4;
 
-	mutex_lock(&device->adc_data.mutex);
-
-	if (channel >= device->adc_data.channel_quantity)
-		return -2;
+	mutex_lock(&device->dac_data.mutex);
 
-	if (!(device->adc_data.channel_mask & (1 << channel))) {
-		mutex_unlock(&device->adc_data.mutex);
+	if (!(device->dac_data.channel_mask & (1 << channel))) {
+		mutex_unlock(&device->dac_data.mutex);
 		return -5;
 	}
 
-	uint32_t step = device->adc_data.sample_size * device->adc_data.work_channel;
-	uint32_t channel_size = ZET017_ADC_BUFFER_SIZE / step;
+	uint32_t step = device->dac_data.sample_size * device->dac_data.channel_quantity;
+	uint32_t channel_size = device->dac_data.size / step;
 	if (pointer >= channel_size || size > channel_size) {
-		mutex_unlock(&device->adc_data.mutex);
+		mutex_unlock(&device->dac_data.mutex);
 		return -6;
 	}
 
 	uint32_t offset = 0;
 	for (uint32_t i = 0; i < channel; ++i) {
-		if (device->adc_data.channel_mask & (1 << i))
-			offset += device->adc_data.sample_size;
+		if (device->dac_data.channel_mask & (1 << i))
+			offset += device->dac_data.sample_size;
 	}
 
+	zet017_quantize_func quantize =
+		device->dac_data.sample_size == sizeof(int16_t) ? zet017_convert.quantize_int16 : zet017_convert.quantize_int32;
+	float scale = 1.f / device->dac_data.resolution[channel];
+
 	uint32_t p = pointer;
 	if (p >= size)
 		p -= size;
 	else
 		p = p + channel_size - size;
-	p *= step;
-	p += offset;
-	for (uint32_t i = 0; i < size; ++i, p += step) {
-		if (p >= ZET017_ADC_BUFFER_SIZE)
-			p -= ZET017_ADC_BUFFER_SIZE;
 
-		if (device->adc_data.sample_size == sizeof(int16_t))
-			data[i] = (float)(*(int16_t*)(device->adc_data.buffer + p));
-		else if (device->adc_data.sample_size == sizeof(int32_t))
-			data[i] = (float)(*(int32_t*)(device->adc_data.buffer + p));
-		data[i] *= device->adc_data.resolution[channel][device->adc_data.amplify_code[channel]];
+	// Written packet by packet, a packet being the unit of the stamps.
+	uint32_t packet_frames = ZET017_PACKET_SIZE / step;
+	for (uint32_t i = 0; i < size;) {
+		uint32_t count = packet_frames - p % packet_frames;
+		if (count > size - i)
+			count = size - i;
+
+		zet017_dac_touch(&device->dac_data, p / packet_frames);
+		quantize(data + i, scale, device->dac_data.buffer + p * step + offset, step, count);
+
+		i += count;
+		p += count;
+		if (p >= channel_size)
+			p = 0;
 	}
 
-	mutex_unlock(&device->adc_data.mutex);
+	mutex_unlock(&device->dac_data.mutex);
 
 	return 0;
 }
 
 ZET017_TCP_API zet017_channel_put_data(
 	struct zet017_server* server, uint32_t number, uint32_t channel, uint32_t pointer, float* data, uint32_t size) {
+	uint32_t epoch = zet017_registry_enter(server);
+	int r = zet017_channel_put_data_impl(server, number, channel, pointer, data, size);
+	zet017_registry_leave(server, epoch);
+
+	return r;
+}
+
+static int zet017_device_put_frames_impl(
+	struct zet017_server* server, uint32_t number, uint32_t pointer, float** data, uint32_t count, uint32_t size) {
 	struct zet017_device* device = zet017_get_device(server, number);
 	if (device == NULL)
 		return -1;
 
-	if (channel >= ZET017_MAX_CHANNELS_DAC)
+	if (count > ZET017_MAX_CHANNELS_DAC)
 		return -2;
 
 	mutex_lock(&device->state_mutex);
@@ -1982,42 +6240,88 @@ ZET017_TCP_API zet017_channel_put_data(
 
 	mutex_lock(&device->dac_data.mutex);
 
-	if (!(device->dac_data.channel_mask & (1 << channel))) {
+	// Channels without data are left as they are; the offsets follow the active channels only.
+	const float* src[ZET017_MAX_CHANNELS_DAC] = { NULL };
+	float scale[ZET017_MAX_CHANNELS_DAC];
+	uint32_t offset[ZET017_MAX_CHANNELS_DAC];
+	uint32_t channels = 0;
+	uint32_t sample_offset = 0;
+	for (uint32_t i = 0; i < ZET017_MAX_CHANNELS_DAC; ++i) {
+		if (!(device->dac_data.channel_mask & (1 << i))) {
+			if (i < count && data[i] != NULL) {
+				mutex_unlock(&device->dac_data.mutex);
+				return -5;
+			}
+			continue;
+		}
+		if (i < count && data[i] != NULL) {
+			src[channels] = data[i];
+			scale[channels] = 1.f / device->dac_data.resolution[i];
+			offset[channels] = sample_offset;
+			++channels;
+		}
+		sample_offset += device->dac_data.sample_size;
+	}
+
+	// No DAC channel is on, or none of them was given data.
+	uint32_t step = device->dac_data.sample_size * device->dac_data.channel_quantity;
+	if (step == 0) {
 		mutex_unlock(&device->dac_data.mutex);
 		return -5;
 	}
+	if (channels == 0) {
+		mutex_unlock(&device->dac_data.mutex);
+		return -4;
+	}
 
-	uint32_t step = device->dac_data.sample_size * device->dac_data.channel_quantity;
-	uint32_t channel_size = ZET017_DAC_BUFFER_SIZE / step;
+	uint32_t channel_size = device->dac_data.size / step;
 	if (pointer >= channel_size || size > channel_size) {
 		mutex_unlock(&device->dac_data.mutex);
 		return -6;
 	}
 
-	uint32_t offset = 0;
-	for (uint32_t i = 0; i < channel; ++i) {
-		if (device->dac_data.channel_mask & (1 << i))
-			offset += device->dac_data.sample_size;
-	}
+	int int16 = device->dac_data.sample_size == sizeof(int16_t);
+	zet017_quantize_func quantize = int16 ? zet017_convert.quantize_int16 : zet017_convert.quantize_int32;
+	zet017_interleave_func interleave = int16 ? zet017_convert.interleave_int16 : zet017_convert.interleave_int32;
+	int interleaved = channels == 2 && step == 2 * device->dac_data.sample_size;
 
 	uint32_t p = pointer;
 	if (p >= size)
 		p -= size;
 	else
 		p = p + channel_size - size;
-	p *= step;
-	p += offset;
-	for (uint32_t i = 0; i < size; ++i, p += step) {
-		if (p >= ZET017_DAC_BUFFER_SIZE)
-			p -= ZET017_DAC_BUFFER_SIZE;
 
-		if (device->dac_data.sample_size == sizeof(int16_t))
-			*(int16_t*)(device->dac_data.buffer + p) = (int16_t)(data[i] / device->dac_data.resolution[channel]);
-		else if (device->dac_data.sample_size == sizeof(int32_t))
-			*(int32_t*)(device->dac_data.buffer + p) = (int32_t)(data[i] / device->dac_data.resolution[channel]);
+	uint32_t packet_frames = ZET017_PACKET_SIZE / step;
+	for (uint32_t i = 0; i < size;) {
+		uint32_t block = packet_frames - p % packet_frames;
+		if (block > size - i)
+			block = size - i;
+
+		zet017_dac_touch(&device->dac_data, p / packet_frames);
+		uint8_t* frames = device->dac_data.buffer + p * step;
+		if (interleaved)
+			interleave(src[0] + i, scale[0], src[1] + i, scale[1], frames, block);
+		else {
+			for (uint32_t j = 0; j < channels; ++j)
+				quantize(src[j] + i, scale[j], frames + offset[j], step, block);
+		}
+
+		i += block;
+		p += block;
+		if (p >= channel_size)
+			p = 0;
 	}
 
 	mutex_unlock(&device->dac_data.mutex);
 
 	return 0;
 }
+
+ZET017_TCP_API zet017_device_put_frames(
+	struct zet017_server* server, uint32_t number, uint32_t pointer, float** data, uint32_t count, uint32_t size) {
+	uint32_t epoch = zet017_registry_enter(server);
+	int r = zet017_device_put_frames_impl(server, number, pointer, data, count, size);
+	zet017_registry_leave(server, epoch);
+
+	return r;
+}